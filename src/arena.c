@@ -0,0 +1,84 @@
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "arena.h"
+
+#define ARENA_BLOCK_SIZE (1 << 20)
+
+struct ArenaBlock
+{
+    ArenaBlock* next;
+    size_t size;
+    size_t used;
+    alignas(max_align_t) unsigned char data[];
+};
+
+static ArenaBlock* create_block(size_t size);
+
+void* arena_alloc(Arena* arena, size_t size)
+{
+    // Round up so that the next allocation stays aligned.
+    const size_t align = alignof(max_align_t);
+    size = (size + align - 1) & ~(align - 1);
+
+    ArenaBlock* block = arena->current;
+    if (!block || block->size - block->used < size)
+    {
+        // Move on to the next block left over from before the last reset, or make a
+        // new one if it's too small.
+        ArenaBlock* next = (block) ? block->next : arena->head;
+        if (next && next->size >= size)
+        {
+            next->used = 0;
+        }
+        else
+        {
+            ArenaBlock* new_block = create_block((size > ARENA_BLOCK_SIZE) ? size : ARENA_BLOCK_SIZE);
+            if (!new_block)
+                return NULL;
+            new_block->next = next;
+            if (block)
+                block->next = new_block;
+            else
+                arena->head = new_block;
+            next = new_block;
+        }
+        block = arena->current = next;
+    }
+
+    void* memory = block->data + block->used;
+    block->used += size;
+    return memory;
+}
+
+void arena_reset(Arena* arena)
+{
+    arena->current = arena->head;
+    if (arena->head)
+        arena->head->used = 0;
+}
+
+void arena_destroy(Arena* arena)
+{
+    ArenaBlock* block = arena->head;
+    while (block)
+    {
+        ArenaBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+    arena->current = NULL;
+}
+
+static ArenaBlock* create_block(size_t size)
+{
+    ArenaBlock* block = malloc(sizeof(ArenaBlock) + size);
+    if (!block)
+        return NULL;
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
@@ -0,0 +1,29 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// A bump allocator. Memory is handed out from large blocks by advancing a pointer
+// and all of it is given back at once with arena_reset. Blocks are kept around after
+// a reset so the next round of allocations does not have to go to malloc.
+//
+// An arena is not thread safe. Threads that allocate concurrently each need their
+// own arena. A zero initialized Arena is empty and ready to use.
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct Arena
+{
+    ArenaBlock* head;
+    ArenaBlock* current; // block allocations are currently being made from
+} Arena;
+
+// Returns size bytes aligned for any type. Returns NULL if out of memory.
+void* arena_alloc(Arena* arena, size_t size);
+
+// Frees everything allocated from the arena but keeps the blocks for reuse.
+void arena_reset(Arena* arena);
+
+// Frees everything allocated from the arena and gives the blocks back to the system.
+void arena_destroy(Arena* arena);
+
+#endif
@@ -12,6 +12,9 @@ static int* SNAKE_DRAFT_PICKS = NULL;
 static void build_snake_order(int n_picks, int n_teams);
 static int find_slot_index(const char* position, const Slot* slots, int num_slots);
 
+// The low bit of the counter of every slot with a nonzero count.
+static SlotCounts open_slots(SlotCounts counts);
+
 const Slot* get_slot(const char* name, const DraftConfig* config)
 {
     for (int i = 0; i < config->num_slots; i++)
@@ -39,6 +42,34 @@ bool flex_includes_position(const Slot* slot, int position)
 	return false;
 }
 
+int count_at_slot(SlotCounts counts, int slot)
+{
+    return (counts >> (SLOT_COUNT_BITS * slot)) & MAX_SLOT_COUNT;
+}
+
+static SlotCounts open_slots(SlotCounts counts)
+{
+    return (counts | counts >> 1 | counts >> 2 | counts >> 3) & 0x1111111111111111ULL;
+}
+
+int fill_slot_counts(const DraftConfig* config, SlotCounts* counts, int position)
+{
+    SlotCounts open = open_slots(*counts) & config->homes[position];
+    SlotCounts own = open & ((SlotCounts)1 << (SLOT_COUNT_BITS * position));
+    // All ones if the position's own slot is open, in which case the flex slots are masked out.
+    SlotCounts own_mask = -(own >> (SLOT_COUNT_BITS * position));
+    SlotCounts filled = own | (open & -open & ~own_mask);
+    *counts -= filled;
+    // ffs is 0 when nothing was filled and 4 * slot + 1 otherwise.
+    return (__builtin_ffsll(filled) + SLOT_COUNT_BITS - 1) / SLOT_COUNT_BITS - 1;
+}
+
+void release_slot_count(SlotCounts* counts, int slot)
+{
+    assert(slot >= 0 && count_at_slot(*counts, slot) < MAX_SLOT_COUNT);
+    *counts += (SlotCounts)1 << (SLOT_COUNT_BITS * slot);
+}
+
 const DraftConfig* load_config(const char* filename)
 {
     DraftConfig* draft = malloc(sizeof(DraftConfig));
@@ -74,6 +105,8 @@ const DraftConfig* load_config(const char* filename)
         return NULL;
     }
     draft->num_slots = slot_count;
+    draft->roster = 0;
+    memset(draft->homes, 0, sizeof(draft->homes));
 
     for (int i = 0; i < slot_count; i++)
     {
@@ -89,8 +122,15 @@ const DraftConfig* load_config(const char* filename)
         {
             fprintf(stderr, "Config Error: Slot %i is missing 'name' or 'number_required'\n", i);
         }
+        if (slot_num_required < 0 || slot_num_required > MAX_SLOT_COUNT)
+        {
+            fprintf(stderr, "Error: Slot %i requires %d players! The limit is %d!\n", i, slot_num_required, MAX_SLOT_COUNT);
+            return NULL;
+        }
         draft->slots[i].index = i;
         draft->slots[i].num_required = slot_num_required;
+        draft->roster |= (SlotCounts)slot_num_required << (SLOT_COUNT_BITS * i);
+        draft->homes[i] |= (SlotCounts)1 << (SLOT_COUNT_BITS * i);
         strncpy(draft->slots[i].name, slot_name, MAX_SLOT_NAME_LENGTH);
 
         // For v1 we just make it so that flex slots must be defined at the end of the slot 
@@ -111,6 +151,7 @@ const DraftConfig* load_config(const char* filename)
                 else
                 {
                     draft->slots[i].flex[j] = index;
+                    draft->homes[index] |= (SlotCounts)1 << (SLOT_COUNT_BITS * i);
                 }
             }
         }
@@ -2,6 +2,7 @@
 #define CONFIG_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 // DRAFT CONFIGURATION CONSTANTS (edit this and recompile to change settings)
 // =================================================================================================
@@ -10,6 +11,12 @@
 
 #define MAX_SLOT_NAME_LENGTH 10
 #define MAX_NUM_SLOTS 15
+#define MAX_SLOT_COUNT 15 // upper bound on number_required of a single slot, see SlotCounts
+
+#define MAX_THREADS 64 // upper bound on the number of threads the engine can search with
+#define MAX_ROLLOUTS 256 // upper bound on the number of rollouts the engine runs per leaf
+#define MAX_WIDENING 8 // upper bound on the number of players per slot the engine considers for a pick
+#define MAX_PONDER_NODES 2000000 // pondering stops once the retained search trees hold this many nodes
 
 /* A slot is a roster position that needs to be filled
  * in a lineup.
@@ -26,17 +33,38 @@ typedef struct Slot
     int flex[MAX_NUM_SLOTS];
 } Slot;
 
+/* How many players a team still needs at every slot, packed into
+ * one word with 4 bits per slot. Slot i's counter is in bits 4i to 4i+3.
+*/
+typedef uint64_t SlotCounts;
+#define SLOT_COUNT_BITS 4
+
 typedef struct DraftConfig
 {
     int num_teams;
     int num_slots;
     Slot slots[MAX_NUM_SLOTS];
+    SlotCounts roster; // number_required of every slot, what each team starts out needing
+    // The slots a player of each position can fill: the low bit of the position's own
+    // counter and of every flex slot's counter that takes the position.
+    SlotCounts homes[MAX_NUM_SLOTS];
 } DraftConfig;
 
 const Slot* get_slot(const char* name, const DraftConfig* config);
 bool is_flex_slot(const Slot* slot);
 bool flex_includes_position(const Slot* slot, int position);
 
+// Number of players still needed at the slot.
+int count_at_slot(SlotCounts counts, int slot);
+
+// Takes one off the counter of the slot a player of the position fills. That is the
+// position's own slot if it is still open, otherwise the first open flex slot that takes
+// the position. Returns the slot or -1 if none of them are open.
+int fill_slot_counts(const DraftConfig* config, SlotCounts* counts, int position);
+
+// Gives back a slot taken by fill_slot_counts.
+void release_slot_count(SlotCounts* counts, int slot);
+
 const DraftConfig* load_config(const char* filename);
 int get_number_of_picks(const DraftConfig* config);
 void assign_pick(int pick, int team);
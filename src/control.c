@@ -11,10 +11,21 @@
 #define ARG_DELIM ";"
 
 // Command functions
+static int run_command(char* command, Engine* engine);
 static int think_pick(const Engine* engine);
 static int make_pick(Engine* engine);
 static int undo_pick(Engine* engine);
 static int set_think_time(Engine* engine);
+static int set_think_nodes(Engine* engine);
+static int set_think_iterations(Engine* engine);
+static int set_threads(Engine* engine);
+static int set_parallel_mode(Engine* engine);
+static int set_rollouts(Engine* engine);
+static int ponder(Engine* engine);
+static int set_transpositions(Engine* engine);
+static int set_widening(Engine* engine);
+static int set_rave(Engine* engine);
+static int set_seed(Engine* engine);
 static int state(const Engine* engine);
 static int history(const Engine* engine);
 static int roster(const Engine* engine);
@@ -43,8 +54,22 @@ static void get_players_at_pos_on_team(
         int num_required
 );
 
-// Parse the input and execute the corresponding logic.
+// The engine stops pondering while a command runs because commands read and modify
+// the draft state that the pondering search works from.
 int do_command(char* command_str, Engine* engine)
+{
+    stop_pondering();
+
+    int result = run_command(command_str, engine);
+
+    if (engine->ponder && result != QUIT && engine->state && engine->config && number_of_players > 0)
+        start_pondering(&engine->search, engine->state->pick, engine->state->taken, engine->config);
+
+    return result;
+}
+
+// Parse the input and execute the corresponding logic.
+static int run_command(char* command_str, Engine* engine)
 {
     if (strlen(command_str) < 1) {
         return 0;
@@ -87,6 +112,46 @@ int do_command(char* command_str, Engine* engine)
     {
         return set_think_time(engine);
     }
+    else if (strcmp(command, "set_think_nodes") == 0 && ready)
+    {
+        return set_think_nodes(engine);
+    }
+    else if (strcmp(command, "set_think_iterations") == 0 && ready)
+    {
+        return set_think_iterations(engine);
+    }
+    else if (strcmp(command, "set_threads") == 0 && ready)
+    {
+        return set_threads(engine);
+    }
+    else if (strcmp(command, "set_parallel_mode") == 0 && ready)
+    {
+        return set_parallel_mode(engine);
+    }
+    else if (strcmp(command, "set_rollouts") == 0 && ready)
+    {
+        return set_rollouts(engine);
+    }
+    else if (strcmp(command, "ponder") == 0 && ready)
+    {
+        return ponder(engine);
+    }
+    else if (strcmp(command, "set_transpositions") == 0 && ready)
+    {
+        return set_transpositions(engine);
+    }
+    else if (strcmp(command, "set_widening") == 0 && ready)
+    {
+        return set_widening(engine);
+    }
+    else if (strcmp(command, "set_rave") == 0 && ready)
+    {
+        return set_rave(engine);
+    }
+    else if (strcmp(command, "set_seed") == 0 && ready)
+    {
+        return set_seed(engine);
+    }
     else if (strcmp(command, "state") == 0 && ready)
     {
         return state(engine);
@@ -139,7 +204,20 @@ void init_engine(Engine* engine)
 {
     engine->state = NULL;
     engine->config = NULL;
-    engine->think_time = 10;
+    engine->search = (SearchSettings) {
+        .budget = BUDGET_TIME,
+        .think_time = 10000,
+        .think_nodes = 0,
+        .think_iterations = 0,
+        .num_threads = 1,
+        .parallel_mode = PARALLEL_ROOT,
+        .rollouts = 1,
+        .transpositions = 0,
+        .widening = 1,
+        .rave = 0,
+        .seed = -1
+    };
+    engine->ponder = false;
 }
 
 void destroy_engine(Engine* engine)
@@ -149,27 +227,23 @@ void destroy_engine(Engine* engine)
     if (engine->config)
         free((DraftConfig*)engine->config);
     destroy_players();
+    free_search_memory();
 }
 
 DraftState* init_draftstate(const DraftConfig* config)
 {
     assert(config != NULL);
-	DraftState* state = malloc(sizeof(DraftState) + sizeof(int*) * config->num_teams);
+	DraftState* state = malloc(sizeof(DraftState) + sizeof(SlotCounts) * config->num_teams);
 
 	int n_picks = get_number_of_picks(config);
 	state->taken = malloc(sizeof(Taken) * n_picks);
     memset(state->taken, 0, n_picks * sizeof(Taken));
+    init_availability(&state->available, state->taken, 0);
 
     state->pick = 0;
 
 	for (int i = 0; i < config->num_teams; i++)
-	{
-		state->still_required[i] = malloc(sizeof(int) * config->num_slots);
-		for (int j = 0; j < config->num_slots; j++)
-		{
-			state->still_required[i][j] = config->slots[j].num_required;
-		}
-	}
+		state->still_required[i] = config->roster;
 
 	return state;
 }
@@ -177,39 +251,13 @@ DraftState* init_draftstate(const DraftConfig* config)
 void destroy_draftstate(DraftState* state, const DraftConfig* config) 
 {
 	free(state->taken);
-	for (int i = 0; i < config->num_teams; i++)
-	{
-		free(state->still_required[i]);
-	}
 	free(state);
 }
 
 static int fill_slot(const PlayerRecord* player, Engine* engine, int team)
 {
-	if (engine->state->still_required[team][player->position] > 0)
-	{
-		engine->state->still_required[team][player->position]--;
-		return 0;
-	}
-	// Decrement first available flex position that fits this player's position
-	else
-	{
-		for (int j = 0; j < engine->config->num_slots; j++)
-		{
-			if (
-				is_flex_slot(&engine->config->slots[j]) && 
-				engine->state->still_required[team][j] > 0 &&
-				flex_includes_position(&engine->config->slots[j], player->position)
-			   )
-			{
-				engine->state->still_required[team][j]--;
-                break; // don't wanna fill up multiple flex's if possible
-			}
-		}
-		return 0;
-	}
-
-    return -1;
+	fill_slot_counts(engine->config, &engine->state->still_required[team], player->position);
+	return 0;
 }
 
 static int think_pick(const Engine* engine)
@@ -218,7 +266,7 @@ static int think_pick(const Engine* engine)
         return runtime_error("No more slots available. Draft is complete.");
 
     const PlayerRecord* player = calculate_best_pick(
-            engine->think_time,
+            &engine->search,
             engine->state->pick,
             engine->state->taken,
             engine->config
@@ -245,7 +293,7 @@ static int make_pick(Engine* engine)
     if (!player)
         return runtime_error("No player exists with that name.");
 
-    if (is_taken(player->id, engine->state->taken, engine->state->pick))
+    if (!is_available(&engine->state->available, player->id))
         return runtime_error("That player has already been picked.");
 
     if (fill_slot(player, engine, team_with_pick(engine->state->pick)) < 0)
@@ -255,7 +303,9 @@ static int make_pick(Engine* engine)
         .player_id = player->id,
         .by_team = team_with_pick(engine->state->pick)
     };
+    mark_taken(&engine->state->available, player->id);
     engine->state->pick++;
+    advance_search_tree(player);
 
     return 0;
 }
@@ -266,20 +316,17 @@ static int undo_pick(Engine* engine)
     if (engine->state->pick <= 0)
         return 0;
 
+    reset_search_tree();
+
     // Reset team requirements then redo picks to rebuild team_requirements.
     // We do this because I think its easier to do this vs figure out if a player was
     // used to fill a FLEX or not.
     for (int i = 0; i < engine->config->num_teams; i++)
-    {
-        // Reset team_requirements
-        for (int j = 0; j < engine->config->num_slots; j++)
-        {
-            engine->state->still_required[i][j] = engine->config->slots[i].num_required;
-        }
-    }
+        engine->state->still_required[i] = engine->config->roster;
 
     // Play back draft up to the pick before last, effectively undoing the last pick.
     engine->state->pick--;
+    mark_available(&engine->state->available, engine->state->taken[engine->state->pick].player_id);
     for (int i = 0; i < engine->state->pick; i++)
     {
         const PlayerRecord* player = get_player_by_id(engine->state->taken[i].player_id);
@@ -289,24 +336,203 @@ static int undo_pick(Engine* engine)
     return 0;
 }
 
+// The think time is given in seconds but can have a fractional part (i.e 0.2) for
+// thinks that are shorter than a second.
 static int set_think_time(Engine* engine)
 {
-    int think_time;
-    if (get_arg_int(&think_time) < 0)
+    const char* arg = get_arg_str();
+    if (!arg)
         return arg_error("set_think_time requires a time_in_seconds argument.");
 
+    int think_time = (int)(strtod(arg, NULL) * 1000);
     if (think_time <= 0)
-        return arg_error("The think time must be an integer (in seconds).");
+        return arg_error("The think time must be a positive number (in seconds).");
+
+    engine->search.budget = BUDGET_TIME;
+    engine->search.think_time = think_time;
+
+    return 0;
+}
+
+static int set_think_nodes(Engine* engine)
+{
+    int nodes;
+    if (get_arg_int(&nodes) < 0)
+        return arg_error("set_think_nodes requires a number of nodes argument.");
+
+    if (nodes <= 0)
+        return arg_error("The number of nodes must be a positive integer.");
+
+    engine->search.budget = BUDGET_NODES;
+    engine->search.think_nodes = nodes;
+
+    return 0;
+}
+
+static int set_think_iterations(Engine* engine)
+{
+    int iterations;
+    if (get_arg_int(&iterations) < 0)
+        return arg_error("set_think_iterations requires a number of iterations argument.");
+
+    if (iterations <= 0)
+        return arg_error("The number of iterations must be a positive integer.");
+
+    engine->search.budget = BUDGET_ITERATIONS;
+    engine->search.think_iterations = iterations;
+
+    return 0;
+}
+
+static int set_threads(Engine* engine)
+{
+    int threads;
+    if (get_arg_int(&threads) < 0)
+        return arg_error("set_threads requires a number of threads argument.");
 
-    engine->think_time = think_time;
+    if (threads <= 0 || threads > MAX_THREADS)
+        return arg_error("The number of threads must be between 1 and MAX_THREADS.");
+
+    engine->search.num_threads = threads;
+
+    return 0;
+}
+
+static int set_parallel_mode(Engine* engine)
+{
+    const char* mode = get_arg_str();
+    if (!mode)
+        return arg_error("set_parallel_mode requires a mode argument (root, tree or leaf).");
+
+    if (strcmp(mode, "root") == 0)
+        engine->search.parallel_mode = PARALLEL_ROOT;
+    else if (strcmp(mode, "tree") == 0)
+        engine->search.parallel_mode = PARALLEL_TREE;
+    else if (strcmp(mode, "leaf") == 0)
+        engine->search.parallel_mode = PARALLEL_LEAF;
+    else
+        return arg_error("The parallel mode must be either root, tree or leaf.");
+
+    return 0;
+}
+
+static int set_rollouts(Engine* engine)
+{
+    int rollouts;
+    if (get_arg_int(&rollouts) < 0)
+        return arg_error("set_rollouts requires a number of rollouts argument.");
+
+    if (rollouts <= 0 || rollouts > MAX_ROLLOUTS)
+        return arg_error("The number of rollouts must be between 1 and MAX_ROLLOUTS.");
+
+    engine->search.rollouts = rollouts;
+
+    return 0;
+}
+
+static int ponder(Engine* engine)
+{
+    const char* arg = get_arg_str();
+    if (!arg)
+        return arg_error("ponder requires an on or off argument.");
+
+    if (strcmp(arg, "on") == 0)
+        engine->ponder = true;
+    else if (strcmp(arg, "off") == 0)
+        engine->ponder = false;
+    else
+        return arg_error("ponder must be turned on or off.");
+
+    return 0;
+}
+
+static int set_transpositions(Engine* engine)
+{
+    int entries;
+    if (get_arg_int(&entries) < 0)
+        return arg_error("set_transpositions requires a number of entries argument.");
+
+    if (entries < 0)
+        return arg_error("The number of entries can't be negative.");
+
+    engine->search.transpositions = entries;
+
+    return 0;
+}
+
+static int set_widening(Engine* engine)
+{
+    int widening;
+    if (get_arg_int(&widening) < 0)
+        return arg_error("set_widening requires a number of players argument.");
+
+    if (widening <= 0 || widening > MAX_WIDENING)
+        return arg_error("The number of players per slot must be between 1 and MAX_WIDENING.");
+
+    engine->search.widening = widening;
+
+    return 0;
+}
+
+static int set_rave(Engine* engine)
+{
+    int rave;
+    if (get_arg_int(&rave) < 0)
+        return arg_error("set_rave requires a number of visits argument.");
+
+    if (rave < 0)
+        return arg_error("The number of visits can't be negative.");
+
+    engine->search.rave = rave;
+
+    return 0;
+}
+
+static int set_seed(Engine* engine)
+{
+    int seed;
+    if (get_arg_int(&seed) < 0)
+        return arg_error("set_seed requires a seed argument.");
+
+    // Negative seeds go back to seeding from the clock.
+    engine->search.seed = (seed >= 0) ? seed : -1;
 
     return 0;
 }
 
 static int state(const Engine* engine)
 {
-    fprintf(stdout, "Pick: %d | Drafting: %d | Engine Think Time: %d\n",
-            engine->state->pick, team_with_pick(engine->state->pick), engine->think_time);
+    static const char* PARALLEL_MODE_NAMES[] = {
+        [PARALLEL_ROOT] = "root",
+        [PARALLEL_TREE] = "tree",
+        [PARALLEL_LEAF] = "leaf"
+    };
+    char budget[50];
+    if (engine->search.budget == BUDGET_NODES)
+        snprintf(budget, sizeof(budget), "%ld nodes", engine->search.think_nodes);
+    else if (engine->search.budget == BUDGET_ITERATIONS)
+        snprintf(budget, sizeof(budget), "%ld iterations", engine->search.think_iterations);
+    else
+        snprintf(budget, sizeof(budget), "%.3fs", engine->search.think_time / 1000.0);
+
+    char transpositions[30] = "off";
+    if (engine->search.transpositions > 0)
+        snprintf(transpositions, sizeof(transpositions), "%ld entries", engine->search.transpositions);
+
+    char rave[30] = "off";
+    if (engine->search.rave > 0)
+        snprintf(rave, sizeof(rave), "%d visits", engine->search.rave);
+
+    char seed[30] = "random";
+    if (engine->search.seed >= 0)
+        snprintf(seed, sizeof(seed), "%d", engine->search.seed);
+
+    fprintf(stdout, "Pick: %d | Drafting: %d | Engine Think Budget: %s | Threads: %d (%s) | Rollouts: %d | Pondering: %s"
+            " | Transpositions: %s | Widening: %d | RAVE: %s | Seed: %s\n",
+            engine->state->pick, team_with_pick(engine->state->pick), budget,
+            engine->search.num_threads, PARALLEL_MODE_NAMES[engine->search.parallel_mode],
+            engine->search.rollouts, (engine->ponder) ? "on" : "off", transpositions,
+            engine->search.widening, rave, seed);
 
     return 0;
 }
@@ -379,7 +605,7 @@ static int available(const Engine* engine)
 
     for (int i = 0; i < num_players; i++)
     {
-        if (!is_taken(players[i].id, engine->state->taken, engine->state->pick))
+        if (is_available(&engine->state->available, players[i].id))
         {
             fprintf(stdout, "%s\n", players[i].name);
             if (--limit <= 0)
@@ -406,15 +632,17 @@ static int bench(Engine* engine)
     if (!player)
         return runtime_error("No player exists with that name.");
 
-    if (is_taken(player->id, engine->state->taken, engine->state->pick))
+    if (!is_available(&engine->state->available, player->id))
         return runtime_error("That player has already been picked.");
 
     engine->state->taken[engine->state->pick] = (Taken) {
         .player_id = player->id,
         .by_team = team_with_pick(engine->state->pick)
     };
+    mark_taken(&engine->state->available, player->id);
 
     engine->state->pick++;
+    advance_search_tree(player);
 
     return 0;
 }
@@ -436,6 +664,8 @@ static int give_pick(Engine* engine)
         return arg_error("invalid team_id");
 
     assign_pick(pick_num, team_id);
+    // The search tree was built assuming the old pick order.
+    reset_search_tree();
 
     return 0;
 }
@@ -483,6 +713,7 @@ static int load(Engine* engine)
     // Reset draft state 
     destroy_draftstate(engine->state, engine->config);
     engine->state = init_draftstate(engine->config);
+    reset_search_tree();
 
     // Every line in the file is a player id in the order in
     // which the players were picked. So first line is the first
@@ -499,7 +730,7 @@ static int load(Engine* engine)
             return runtime_error("Loading Error. Player not found.");
         }
 
-        if (is_taken(player->id, engine->state->taken, engine->state->pick))
+        if (!is_available(&engine->state->available, player->id))
         {
             fclose(f);
             return runtime_error("Loading Error. Player has already been picked.");
@@ -514,6 +745,7 @@ static int load(Engine* engine)
             .player_id = player->id,
             .by_team = team_with_pick(engine->state->pick)
         };
+        mark_taken(&engine->state->available, player->id);
 
         engine->state->pick++;
     }
@@ -542,6 +774,11 @@ static int load_draft_config(Engine* engine)
 
     engine->state = init_draftstate(new_config);
     engine->config = new_config;
+    reset_search_tree();
+
+    // The flex orderings and z-scores of a loaded pool depend on the roster slots and number of teams.
+    if (number_of_players > 0 && apply_config_to_players(new_config) < 0)
+        return runtime_error("Could not calculate z-scores for the player pool.");
 
     return 0;
 }
@@ -557,6 +794,7 @@ static int load_player_pool(Engine* engine)
 
     destroy_draftstate(engine->state, engine->config);
     engine->state = init_draftstate(engine->config);
+    reset_search_tree();
 
     return 0;
 }
@@ -567,7 +805,7 @@ static int sim_draft(Engine* engine)
     while (engine->state->pick < n_picks)
     {
         const PlayerRecord* player = calculate_best_pick(
-                engine->think_time,
+                &engine->search,
                 engine->state->pick,
                 engine->state->taken,
                 engine->config
@@ -578,8 +816,10 @@ static int sim_draft(Engine* engine)
             .player_id = player->id,
             .by_team = team_with_pick(engine->state->pick)
         };
+        mark_taken(&engine->state->available, player->id);
         fprintf(stdout, "%s\n", player->name);
         engine->state->pick++;
+        advance_search_tree(player);
     }
 
     return 0;
@@ -3,6 +3,7 @@
 
 #include "players.h"
 #include "config.h"
+#include "drafter.h"
 
 #define VERSION_MAJOR 1
 #define VERSION_MINOR 1
@@ -12,14 +13,16 @@ typedef struct DraftState
 {
     int pick;
     Taken* taken;
-    int* still_required[];
+    Availability available; // kept in sync with taken
+    SlotCounts still_required[];
 } DraftState;
 
 typedef struct Engine
 {
     DraftState* state;
     const DraftConfig* config;
-    int think_time;
+    SearchSettings search;
+    bool ponder;
 } Engine;
 
 #define ERR_UNK_COMMAND -1
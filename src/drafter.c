@@ -1,14 +1,19 @@
 #include <assert.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
 
 #include "drafter.h"
+#include "arena.h"
 #include "config.h"
+#include "pool.h"
 
 // Globals which are set by the corresponding values the passed DraftConfig to 
 // calculate_best_pick. These values get set at the beginning of 
@@ -17,59 +22,310 @@ static int NUMBER_OF_TEAMS = 0;
 static int NUMBER_OF_SLOTS = 0;
 static int NUMBER_OF_PICKS = 0;
 
-// Zscores get calculated and stashed in this array at beginning 
-// of calculate_best_pick.
-// TODO: Ideally we would dynamically allocate this to the number of
-// players in the player pool but just using a static buffer is alright
-// for now.
-static double zscores[1000];
+// Number of players per slot that expansion adds as children (see expand_tree). Set
+// from the SearchSettings at the beginning of a search.
+static int WIDENING = 1;
+
+// RAVE equivalence parameter: the number of visits at which a node's own statistics and
+// its AMAF statistics weigh the same in selection. 0 turns RAVE off. Set from the
+// SearchSettings at the beginning of a search.
+static int RAVE_EQUIVALENCE = 0;
+
+// Whether nodes keep the zobrist hash of their draft state, which only the transposition
+// table needs. Set from the SearchSettings at the beginning of a search.
+static bool NODE_HASHES = false;
+
+// Expansion states of a node. A thread must move a node from NODE_UNEXPANDED to
+// NODE_EXPANDING before it creates the node's children, so threads sharing a tree
+// never expand the same node twice. The children are only read once the node is
+// NODE_EXPANDED. A node is NODE_EXHAUSTED once everything below it is in the tree
+// (see mark_exhausted), which also means it is expanded.
+enum { NODE_UNEXPANDED, NODE_EXPANDING, NODE_EXPANDED, NODE_EXHAUSTED };
+
+// Visits a thread temporarily adds to every node on its path while its rollout is
+// in flight. When threads share a tree this makes the branch look worse to the
+// other threads and pushes them onto different branches.
+#define VIRTUAL_LOSS 3
+
+// The search trees are stored as a structure of arrays. A node is referred to by a
+// 32-bit NodeRef and each of its fields lives in its own array, so the same field of
+// sibling nodes sits side by side in memory. The children of a node are allocated as
+// contiguous blocks and the node only records where the blocks start and how long
+// they are. Selection then streams through the children's statistics instead of
+// chasing a pointer per slot.
+typedef uint32_t NodeRef;
+#define NULL_NODE UINT32_MAX
+// extra_child of a node whose extra children are being allocated by another thread, or
+// couldn't be allocated. Never a real node since the last store index is never used.
+#define PENDING_NODE (UINT32_MAX - 1)
+
+// Player id of the root, which doesn't have a player associated to it.
+#define NO_PLAYER UINT16_MAX
+_Static_assert(MAX_PLAYERS < NO_PLAYER, "player ids must fit in a NodeChunk's player_id");
+
+// Nodes are handed out in chunks of NODE_CHUNK_SIZE. The lower NODE_INDEX_BITS of a
+// NodeRef are the node's index in its store and the bits above are the store.
+#define NODE_CHUNK_BITS 12
+#define NODE_CHUNK_SIZE (1 << NODE_CHUNK_BITS)
+#define NODE_INDEX_BITS 24
+#define MAX_NODE_CHUNKS (1 << (NODE_INDEX_BITS - NODE_CHUNK_BITS))
+_Static_assert(MAX_THREADS <= (1 << (32 - NODE_INDEX_BITS)) - 1, "store index must fit in a NodeRef");
+_Static_assert(MAX_NUM_SLOTS * MAX_WIDENING <= UINT8_MAX, "children must fit in num_children");
+
+// Children past a node's initial ones become selectable one at a time as the node gets
+// visited: a node with v visits can select num_initial + WIDENING_RATE * sqrt(v) children.
+// Most nodes are only visited once or twice, so the children past the initial ones are
+// only allocated once the first of them opens up (see widen_children).
+#define WIDENING_RATE 0.5
+
+// Selection looks the square roots and logs of visit counts below UCB_TABLE_SIZE up in
+// tables instead of computing them for every child on every descent.
+#define UCB_TABLE_SIZE (1 << 16)
+static double SQRT_LOG_TABLE[UCB_TABLE_SIZE]; // sqrt(log(v))
+static double INV_SQRT_TABLE[UCB_TABLE_SIZE]; // 1 / sqrt(v), 0 for v = 0
+static pthread_once_t UCB_TABLES_ONCE = PTHREAD_ONCE_INIT;
+
+// Node statistics are atomics so that threads can descend and update a shared tree
+// without locks. The score of node i for a team is
+// score_sums[i * NUMBER_OF_TEAMS + team] / visited[i].
+//
+// The AMAF (all moves as first) statistics of a node are the score shares of the team
+// picking the node's player from every rollout through the node's parent in which that
+// team took the node's player, no matter at which pick (see update_amaf).
+//
+// The hashes and AMAF statistics are only allocated behind the score sums when the
+// search uses them, so a chunk without them costs nothing extra.
+typedef struct NodeChunk
+{
+    atomic_int visited[NODE_CHUNK_SIZE];
+    atomic_int virtual_loss[NODE_CHUNK_SIZE];
+    NodeRef first_child[NODE_CHUNK_SIZE]; // block of the initial children
+    _Atomic NodeRef extra_child[NODE_CHUNK_SIZE]; // block of the rest. NULL_NODE until widen_children
+    uint16_t player_id[NODE_CHUNK_SIZE];
+    uint8_t num_children[NODE_CHUNK_SIZE];
+    uint8_t num_initial[NODE_CHUNK_SIZE]; // children that can be selected from the first visit on
+    atomic_uchar expansion[NODE_CHUNK_SIZE];
+    uint64_t* hash; // zobrist hash of the draft state of every node. NULL unless NODE_HASHES
+    atomic_int* amaf_visits; // NULL unless RAVE is on
+    _Atomic double* amaf_sums; // NULL unless RAVE is on
+    _Atomic double score_sums[]; // NODE_CHUNK_SIZE * NUMBER_OF_TEAMS
+} NodeChunk;
+
+// Each search thread allocates its nodes from its own store, even when the threads
+// share one tree. The chunks of a store come out of its arena and a child block never
+// straddles two chunks.
+//
+// There are two sets of stores. Nodes get allocated from the active set while the
+// other set is only used when the trees get re-rooted (see advance_search_tree).
+typedef struct NodeStore
+{
+    Arena arena;
+    uint32_t size; // number of node indices handed out since the last reset
+    NodeChunk* chunks[MAX_NODE_CHUNKS];
+} NodeStore;
+
+static NodeStore NODE_STORES[2][MAX_THREADS];
+static int ACTIVE_STORES = 0;
+
+// The trees of the last search are kept around and re-rooted as the real draft
+// advances so the next search starts with the statistics the last one gathered.
+// RETAINED_PICK is the pick the retained roots represent, or -1 if there are none.
+static NodeRef RETAINED_ROOTS[MAX_THREADS];
+static int NUM_RETAINED = 0;
+static int RETAINED_PICK = -1;
+
+// A draft state is hashed by XORing together a random key for every (player, team that
+// took the player) pair plus ZOBRIST_BASE. Two pick orders that end up with the same
+// players on the same teams hash the same no matter what order the picks were made in,
+// and making or undoing a pick is one XOR. The keys are generated the same way every
+// time so hashes stay valid from one search to the next.
+static uint64_t* ZOBRIST_KEYS = NULL; // number_of_players * NUMBER_OF_TEAMS keys
+static int NUM_ZOBRIST_KEYS = 0;
+static uint64_t ZOBRIST_BASE = 0;
+
+// The transposition table shares the statistics of draft states that show up more than
+// once in the search trees. It is a fixed size hash table of buckets of
+// TRANSPOSITION_BUCKET_SIZE entries. A state that isn't in its bucket replaces the
+// bucket's least visited entry. The table is only consulted for the scores used in
+// selection; the visit counts that drive exploration stay with the tree's nodes.
+//
+// Entries are updated without locks. A replacement racing with an update of the entry
+// it replaces can leave a stray score behind, which the table can live with since
+// it only ever holds estimates.
+#define TRANSPOSITION_BUCKET_SIZE 4
 
-typedef struct Node
+typedef struct TranspositionEntry
 {
-    int visited;
-    double* scores;
-    const PlayerRecord* chosen_player;
-    struct Node* parent;
-	struct Node* children[];
-} Node;
+    atomic_ullong hash; // 0 if the entry is empty
+    atomic_int visited;
+    _Atomic double score_sums[]; // NUMBER_OF_TEAMS
+} TranspositionEntry;
+
+static struct
+{
+    unsigned char* entries;
+    size_t num_buckets; // power of two. 0 if the table is off
+    size_t entry_size;
+    int teams; // NUMBER_OF_TEAMS the entries were sized for
+} TRANSPOSITIONS;
+
+// xoshiro256** (https://prng.di.unimi.it/). Every context that rollouts play out in has a
+// generator of its own, so rollouts on different threads never contend for one, and a
+// search with a fixed seed plays out the same rollouts every time.
+typedef struct Rng
+{
+    uint64_t s[4];
+} Rng;
 
 // We will be going down "experimental" branches of draft trees
 // and will need a way to keep track/reset search state when
 // we want to switch to a different branch. This structure
 // packs all this context data together.
+//
+// Every pick made in a context is journaled in filled_slots so that it can be taken
+// back with undo_picks. Going back up the tree then only costs as much as the number
+// of picks that were made on the way down.
+//
+// available mirrors taken as a bitset and cursors point at the best available player
+// at each position, so the rollout policies can look up the best available players
+// without replaying the taken list or scanning the player table. hash is the zobrist
+// hash of the picks made so far.
+//
+// team_points adds up the projected points every team got from the picks made in the
+// context since it was created, so the rollouts start from the points of the picks
+// made on the way down the tree instead of walking back up to add them up.
+//
+// pool tracks what is left of every position's draftable pool so the zscore rollout
+// policy judges value against the players who are still around.
 typedef struct SearchContext
 {
-	Node* node;
+	NodeRef node;
 	int pick;
 	Taken* taken;
-    int* team_requirements[];
+    uint64_t hash;
+    Availability available;
+    PositionCursors cursors;
+    PoolStats pool;
+    Rng rng; // not touched by reset_search_context_to, every rollout context keeps its own
+    int* filled_slots; // slot the player taken at each pick filled. -1 if it filled none.
+    double* team_points; // NUMBER_OF_TEAMS
+    double* prior_points; // team_points of the team with each pick before the pick was made
+    PoolSums* prior_pool; // pool sums of the position of the player taken at each pick before the pick
+    SlotCounts team_requirements[];
 } SearchContext;
 
-static Node* create_node(Node* parent, const PlayerRecord* chosen_player);
-static void free_node(Node *node);
+// Allocates count contiguous nodes from a store of the given set. The nodes still need
+// to be initialized with init_node. Returns NULL_NODE if the store is full or out of memory.
+static NodeRef create_nodes(int set, int store, int count);
+static void init_node(int set, NodeRef node, uint16_t player_id, uint64_t hash);
+static void reset_node_store(NodeStore* store);
+
+// Returns the chunk of a node in the given set of stores and sets index to the
+// node's index within the chunk. node_chunk looks the node up in the active set.
+static NodeChunk* node_chunk_in(int set, NodeRef node, int* index);
+static NodeChunk* node_chunk(NodeRef node, int* index);
+static const PlayerRecord* node_player(NodeRef node);
+
+// Zobrist hash of the i-th node of the chunk. 0 if the chunk doesn't keep hashes.
+static uint64_t node_hash(const NodeChunk* chunk, int i);
+
+// Deep copies the node and all of its descendants into a store of the spare set.
+static NodeRef copy_subtree(int store, NodeRef node);
+static void copy_children(int store, NodeRef node, NodeRef copy);
+
+// Generates the zobrist keys for the loaded players and number of teams.
+static void init_zobrist_keys();
+static uint64_t zobrist_key(unsigned int player_id, int team);
+static uint64_t hash_taken(const Taken taken[], int pick);
+
+// Seeds the generator with stream of seed. Different streams of a seed are independent.
+static void seed_rng(Rng* rng, uint64_t seed, uint64_t stream);
+static uint64_t next_random(Rng* rng);
+
+// Sizes the transposition table to hold up to entries entries. 0 turns it off. The table
+// keeps its contents unless its size changes.
+static void resize_transpositions(long entries);
+static void clear_transpositions();
+static TranspositionEntry* transposition_entry(size_t bucket, int i);
+// Returns the entry of the state with the hash or NULL if the state isn't in the table.
+static const TranspositionEntry* probe_transposition(uint64_t hash);
+// Adds the scores of every team to the state's entry, replacing another state's entry if needed.
+static void store_transposition(uint64_t hash, const double scores[]);
 
 static SearchContext* create_search_context(int pick, const Taken* taken, const DraftConfig* config);
 static void destroy_search_context(SearchContext* context);
 static void reset_search_context_to(const SearchContext* original, SearchContext* delta);
 
-static Node* select_child(const Node* parent, int team);
-static double calculate_ucb(const Node* node, int team);
-static bool is_leaf(const Node* node);
+// Takes back the picks made in the context until it is at pick again.
+static void undo_picks(SearchContext* context, int pick);
+
+static NodeRef select_child(NodeRef parent, int team);
+
+// UCB score of the i-th node of the chunk, which has been visited visits times, for the
+// team picking at its parent. exploration is 2 * sqrt(log(parent visits)), which is the
+// same for all of the parent's children so select_child works it out once.
+static double calculate_ucb(const NodeChunk* chunk, int i, int visits, double exploration, int team);
+
+static void init_ucb_tables();
+static double sqrt_log(int visits);
+static double inv_sqrt(int visits);
+static bool is_leaf(NodeRef node);
+
+// Number of the node's children select_child chooses from after visits visits.
+static int num_open_children(const NodeChunk* chunk, int i, int visits);
+
+// Puts the blocks of the i-th node of the chunk's allocated children in blocks and their
+// lengths in sizes. Returns the number of blocks, which is 0 for a leaf.
+static int child_blocks(const NodeChunk* chunk, int i, NodeRef blocks[2], int sizes[2]);
+
+// The child-th child of the i-th node of the chunk. NULL_NODE if it isn't allocated yet.
+static NodeRef child_at(const NodeChunk* chunk, int i, int child);
+
+// Marks the last node of the path exhausted, which it has to be, and then every node
+// above it whose children are all open and exhausted. Searching an exhausted tree any
+// further can't add nodes to it.
+static void mark_exhausted(const NodeRef path[], int length);
+
+// Score of the i-th node of the chunk for the team. Comes from the transposition table
+// when the node's state is in it.
+static double state_score(const NodeChunk* chunk, int i, int team);
+
+// Visits including the virtual losses of rollouts that are still in flight.
+static int effective_visits(NodeRef node);
+static void apply_virtual_loss(const NodeRef path[], int length, int loss);
 
 // Decrement number of still required from a team's roster requirements 
 // based on the player's position and the remaining slots available on 
 // team's roster. Will automatically fill a FLEX slot if necessary. Does NOT
 // affect the context's "taken" state or increment the current context's pick.
-static void fill_slot(SearchContext* context, const PlayerRecord* player, int team, const DraftConfig* config);
+// Returns the index of the slot that was filled or -1 if no slot had room.
+static int fill_slot(SearchContext* context, const PlayerRecord* player, int team, const DraftConfig* config);
 
 // Marks player as taken in the given context, calls fill_slot to update the
 // team's roster requirements, and increments the context's pick state.
 static void make_pick(SearchContext* context, const PlayerRecord* player, const DraftConfig* config);
 
-// Creates next level of tree from the passed leaf node. Creates 
+// Creates next level of tree from the passed leaf node. Creates up to
 // NUMBER_OF_SLOTS new children where each child represents picking the player
-// at that slot with the highest point total.
-static void expand_tree(Node* node, const SearchContext* context, const DraftConfig* config);
+// at that slot with the highest point total. Does nothing if another thread has
+// already claimed the node for expansion. Returns the number of children created.
+// The context is used as scratch space but is back in its original state on return.
+static int expand_tree(int store, NodeRef node, SearchContext* context, const DraftConfig* config);
+
+// Puts the players the children of a node at the context's state pick into players, and
+// the hashes of the states they lead to into hashes. Sets initial to the number of
+// children that are open from the first visit on. Returns the number of children.
+static int list_children(
+        const SearchContext* context, 
+        const DraftConfig* config, 
+        const PlayerRecord* players[], 
+        uint64_t hashes[], 
+        int* initial);
+
+// Allocates the children of the expanded node past its initial ones once select_child is
+// about to open the first of them. The context has to be at the node's state, i.e. the
+// node's pick has been made. Returns the number of children created.
+static int widen_children(int store, NodeRef node, const SearchContext* context, const DraftConfig* config);
 
 // What we are measuring is not raw score but rather score share. For example, if we were simply maximizing
 // the drafting player's score, we could have the following opportunity:
@@ -90,9 +346,18 @@ static void expand_tree(Node* node, const SearchContext* context, const DraftCon
 // disguise the fact that I'm not 100% sure about the validity of my statement and am instead relying
 // on intuition.) AKA... Just trust me bro.
 //
-// So the returned value of this function is actually a value in the range [0, 1] which corresponds with
-// the percentage of the total score "pie" obtained for the player.
-static double simulate_score(const SearchContext* context, const Node* from_node, const DraftConfig* config);
+// So the values this function puts in shares are in the range [0, 1] and correspond with the percentage
+// of the total score "pie" obtained by each team. Every team's share is returned, not just the drafting
+// team's, so one rollout updates the statistics of every team along the path (max^n style): the nodes
+// where opponents are on the clock learn from it just as much as the drafting team's nodes.
+//
+// The simulation is played out in sim_search_context, a scratch copy of the search context at from_node that
+// is left at the end of the draft.
+static void simulate_score(
+        SearchContext* sim_search_context, 
+        NodeRef from_node, 
+        const DraftConfig* config, 
+        double shares[]);
 
 // These functions are responsible for the simulation phase of the monte carlo search. These have very
 // important ramifications on the performance of the algorithm. My methodology when simming a single pick
@@ -103,161 +368,1036 @@ static double simulate_score(const SearchContext* context, const Node* from_node
 //
 // Pure MCTS calls for just the random pick method, but experimentally I have discovered that adding
 // the zscore method significantly improved the quality of the picks.
-static const PlayerRecord* sim_pick_for_team(const SearchContext* context, const DraftConfig* config);
-static const PlayerRecord* zscore_pick_method(const SearchContext* context, const DraftConfig* config);
-static const PlayerRecord* greedy_pick_method(const SearchContext* context, const DraftConfig* config);
-static const PlayerRecord* random_pick_method(const SearchContext* context, const DraftConfig* config);
+//
+// sim_pick_for_team looks up the best available player of every slot the team still needs once and
+// the methods only choose among those candidates.
+static const PlayerRecord* sim_pick_for_team(SearchContext* context);
+static const PlayerRecord* zscore_pick_method(
+        const SearchContext* context, 
+        const PlayerRecord* const candidates[], 
+        int count);
+static const PlayerRecord* greedy_pick_method(const PlayerRecord* const candidates[], int count);
+static const PlayerRecord* random_pick_method(Rng* rng, const PlayerRecord* const candidates[], int count);
+
+// Same as make_pick but leaves the zobrist hash and the undo journal alone, since nothing
+// hashes or undoes the picks of a rollout. A context that had rollout picks made in it
+// can only be brought back with reset_search_context_to.
+static void make_rollout_pick(SearchContext* context, const PlayerRecord* player, const DraftConfig* config);
+
+static void backpropogate_score(const NodeRef path[], int length, const double scores[]);
+
+// Adds the finished rollout in sim_context to the AMAF statistics of the children of
+// every node on the path. The path starts at the root, which is at root_pick. The score
+// shares only count the picks made from root_pick on.
+static void update_amaf(const NodeRef path[], int length, const SearchContext* sim_context, int root_pick);
+static void atomic_add_double(_Atomic double* target, double value);
+
+
+// Decides when a search is over. Shared by all the workers of a search. The node and
+// iteration counts only include the work done by this search, not the work that is
+// carried over in the retained trees.
+typedef struct SearchLimits
+{
+    const atomic_bool* stop; // the search stops early when set. May be NULL.
+    long long deadline; // monotonic time in ms the search stops at. Negative if there is none.
+    long max_nodes; // 0 if there is no limit
+    long max_iterations; // 0 if there is no limit
+    atomic_long nodes;
+    atomic_long iterations;
+} SearchLimits;
+
+// Upper bound on the number of nodes a tree rooted at pick can grow to with the given
+// widening. Stops counting at limit.
+static long search_space_size(int pick, int widening, long limit, const DraftConfig* config);
+
+// Milliseconds on a monotonic clock. Only good for measuring intervals.
+static long long now_ms();
+
+// In PARALLEL_ROOT mode each worker thread grows its own independent search tree from
+// the same draft state and the statistics of the workers' root children get merged
+// together to choose the pick. In PARALLEL_TREE mode every worker descends the same
+// tree. In PARALLEL_LEAF mode a single worker grows the tree and runs the rollouts of
+// each new leaf on a thread pool.
+typedef struct SearchWorker
+{
+    pthread_t thread;
+    int store; // index of the store the worker allocates its nodes from
+    NodeRef root;
+    bool shared_tree;
+    ThreadPool* pool; // NULL unless the worker's rollouts run in parallel
+    int rollouts; // number of rollouts averaged together per leaf
+    uint64_t seed; // seed of the worker's rollout generators
+    int pick;
+    const Taken* taken;
+    const DraftConfig* config;
+    SearchLimits* limits;
+} SearchWorker;
+
+static void* run_search_worker(void* arg);
+static void grow_tree(SearchWorker* worker);
+static bool is_search_over(const SearchWorker* worker);
+
+// A batch of rollouts from the same leaf. Each rollout plays out in its own scratch
+// context from sim_contexts and stores the score shares of the teams at
+// scores[index * NUMBER_OF_TEAMS].
+typedef struct RolloutBatch
+{
+    const SearchContext* context;
+    SearchContext** sim_contexts;
+    const NodeRef* path; // from the root to the leaf the rollouts start at
+    int length;
+    int root_pick; // pick the root of the tree is at
+    const DraftConfig* config;
+    double* scores;
+} RolloutBatch;
+
+// Runs the worker's batch of rollouts from the leaf and puts the average score share of
+// every team in scores.
+static void simulate_batch(
+        const SearchWorker* worker, 
+        const SearchContext* context, 
+        SearchContext** sim_contexts, 
+        const NodeRef path[],
+        int length,
+        const DraftConfig* config,
+        double scores[]);
+static void run_rollout(void* arg, int index);
+
+// Grows the retained search trees for the draft state at pick. A new tree gets
+// started for every tree that's missing. Searches until one of the limits is hit.
+static void run_search(
+    const SearchSettings* settings, 
+    SearchLimits* limits,
+    int pick, 
+    const Taken taken[], 
+    const DraftConfig* draft_config);
+
+// Merges the root children of the retained trees and returns the player with the
+// highest score for the team picking at pick. Returns NULL if there is no tree.
+static const PlayerRecord* best_retained_pick(int pick);
+
+// Drops the retained trees if a search at pick with the given settings can't reuse them.
+static void discard_stale_trees(const SearchSettings* settings, int pick);
+// Number of nodes the retained trees hold.
+static long retained_nodes(void);
+
+// State of the search started by start_pondering. Only touched by the thread that
+// calls start_pondering and stop_pondering.
+static struct
+{
+    pthread_t thread;
+    bool running;
+    atomic_bool stop;
+    SearchSettings settings;
+    int pick;
+    Taken* taken; // copy of the draft's taken list
+    const DraftConfig* config;
+} PONDER;
 
-static void backpropogate_score(Node* node, double score, int team);
-static void calculate_zscores(const DraftConfig* config);
+// Milliseconds spent pondering on the retained trees since they were rooted at
+// RETAINED_PICK. The time counts towards the think time of the next search.
+static long long PONDERED_TIME = 0;
 
+static void* run_ponder(void* arg);
 
 // Uses the Monte Carlo Tree Search Algorithm to find which available player 
 // maximizes the teams total projected fantasy points.
 // More on MCTS: https://www.geeksforgeeks.org/ml-monte-carlo-tree-search-mcts/
 const PlayerRecord* calculate_best_pick(
-    int thinking_time, 
+    const SearchSettings* settings,
     int pick, 
     Taken taken[], 
     const DraftConfig* draft_config)
 {
+    assert(!PONDER.running);
+
+    SearchLimits limits = {
+        .stop = NULL,
+        .deadline = -1,
+        .max_nodes = 0,
+        .max_iterations = 0
+    };
+    atomic_init(&limits.nodes, 0);
+    atomic_init(&limits.iterations, 0);
+
+    switch (settings->budget)
+    {
+        case BUDGET_NODES:
+            // Iterations that end at the end of the draft add no nodes, so late in the draft
+            // the tree may never reach the budget. The budget is capped by how big the tree
+            // can get and also bounds the iterations, which add at least a node each
+            // until the tree runs out of picks to add.
+            limits.max_nodes = search_space_size(pick, settings->widening, settings->think_nodes, draft_config);
+            limits.max_iterations = limits.max_nodes;
+            break;
+        case BUDGET_ITERATIONS:
+            limits.max_iterations = settings->think_iterations;
+            break;
+        case BUDGET_TIME:
+        default:
+        {
+            long long pondered = (RETAINED_PICK == pick) ? PONDERED_TIME : 0;
+            limits.deadline = now_ms() + settings->think_time - pondered;
+            break;
+        }
+    }
+    run_search(settings, &limits, pick, taken, draft_config);
+
+    return best_retained_pick(pick);
+}
+
+void start_pondering(
+    const SearchSettings* settings,
+    int pick,
+    const Taken taken[],
+    const DraftConfig* draft_config)
+{
+    int n_picks = get_number_of_picks(draft_config);
+    if (PONDER.running || pick >= n_picks)
+        return;
+
+    PONDER.settings = *settings;
+    PONDER.pick = pick;
+    PONDER.config = draft_config;
+    PONDER.taken = malloc(sizeof(Taken) * n_picks);
+    memcpy(PONDER.taken, taken, sizeof(Taken) * n_picks);
+    atomic_store(&PONDER.stop, false);
+
+    if (pthread_create(&PONDER.thread, NULL, run_ponder, NULL) != 0)
+    {
+        fprintf(stderr, "Warning: Could not start pondering thread.\n");
+        free(PONDER.taken);
+        return;
+    }
+    PONDER.running = true;
+}
+
+void stop_pondering()
+{
+    if (!PONDER.running)
+        return;
+
+    atomic_store(&PONDER.stop, true);
+    pthread_join(PONDER.thread, NULL);
+    free(PONDER.taken);
+    PONDER.running = false;
+}
+
+static void* run_ponder(void* arg)
+{
+    // Pondering has no clock, so the node limit is what keeps a long wait from
+    // growing the trees until the memory runs out. Pondering restarts after every
+    // command, so the limit counts the nodes the retained trees already hold.
+    discard_stale_trees(&PONDER.settings, PONDER.pick);
+    long budget = MAX_PONDER_NODES - retained_nodes();
+    if (budget <= 0)
+        return NULL;
+    SearchLimits limits = {
+        .stop = &PONDER.stop,
+        .deadline = -1,
+        .max_nodes = budget,
+        .max_iterations = 0
+    };
+    atomic_init(&limits.nodes, 0);
+    atomic_init(&limits.iterations, 0);
+
+    long long start_time = now_ms();
+    run_search(&PONDER.settings, &limits, PONDER.pick, PONDER.taken, PONDER.config);
+    PONDERED_TIME += now_ms() - start_time;
+    return NULL;
+}
+
+static void discard_stale_trees(const SearchSettings* settings, int pick)
+{
+    // The retained trees are only valid if the draft advanced through
+    // advance_search_tree since the last search and they were grown with the
+    // same widening (otherwise their child blocks don't line up with new trees).
+    // Their chunks also have to carry the hashes and AMAF statistics this search uses.
+    if (RETAINED_PICK != pick || WIDENING != settings->widening ||
+            NODE_HASHES != (settings->transpositions > 0) || (RAVE_EQUIVALENCE > 0) != (settings->rave > 0))
+        reset_search_tree();
+}
+
+static long retained_nodes(void)
+{
+    long nodes = 0;
+    for (int i = 0; i < MAX_THREADS; i++)
+        nodes += NODE_STORES[ACTIVE_STORES][i].size;
+    return nodes;
+}
+
+static void run_search(
+    const SearchSettings* settings, 
+    SearchLimits* limits,
+    int pick, 
+    const Taken taken[], 
+    const DraftConfig* draft_config)
+{
+    int num_threads = settings->num_threads;
+    assert(num_threads > 0 && num_threads <= MAX_THREADS);
+    assert(settings->rollouts > 0);
+    bool shared_tree = settings->parallel_mode == PARALLEL_TREE;
+
+    discard_stale_trees(settings, pick);
+    assert(settings->widening > 0 && settings->widening <= MAX_WIDENING);
+    WIDENING = settings->widening;
+    RAVE_EQUIVALENCE = settings->rave;
+    NODE_HASHES = settings->transpositions > 0;
+
     // Set globals from values in draft_config
     NUMBER_OF_SLOTS = draft_config->num_slots;
     NUMBER_OF_TEAMS = draft_config->num_teams;
     NUMBER_OF_PICKS = get_number_of_picks(draft_config);
-    calculate_zscores(draft_config);
+    init_zobrist_keys();
+    pthread_once(&UCB_TABLES_ONCE, init_ucb_tables);
+    resize_transpositions(settings->transpositions);
+
+    // Without a fixed seed every search plays out different rollouts. With one, the
+    // rollouts only depend on the seed and the pick.
+    uint64_t seed = (settings->seed >= 0) ? (uint64_t)settings->seed : (uint64_t)time(NULL) ^ (uint64_t)now_ms();
+    seed ^= (uint64_t)pick << 32;
+
+    // Leaf parallelization only has one worker growing the tree. The rest of the
+    // threads help out with its rollouts.
+    ThreadPool* pool = NULL;
+    if (settings->parallel_mode == PARALLEL_LEAF)
+    {
+        if (num_threads > 1 && (pool = create_pool(num_threads - 1)) == NULL)
+            fprintf(stderr, "Warning: Could not start rollout threads. Running rollouts serially.\n");
+        num_threads = 1;
+    }
+
+    // Pick up the retained trees where the last search left off. Retained trees that
+    // are not needed anymore (i.e the number of threads went down) get dropped.
+    int num_roots = (shared_tree) ? 1 : num_threads;
+    NodeRef roots[num_roots];
+    for (int i = 0; i < num_roots; i++)
+    {
+        if (i < NUM_RETAINED)
+        {
+            roots[i] = RETAINED_ROOTS[i];
+        }
+        else if ((roots[i] = create_nodes(ACTIVE_STORES, i, 1)) != NULL_NODE)
+        {
+            init_node(ACTIVE_STORES, roots[i], NO_PLAYER, hash_taken(taken, pick));
+        }
+        else
+        {
+            fprintf(stderr, "Warning: Out of memory for the search tree.\n");
+            destroy_pool(pool);
+            return;
+        }
+    }
+
+    SearchWorker workers[num_threads];
+    for (int i = 0; i < num_threads; i++)
+    {
+        workers[i] = (SearchWorker) {
+            .store = i,
+            .root = (shared_tree) ? roots[0] : roots[i],
+            .shared_tree = shared_tree,
+            .pool = pool,
+            .rollouts = settings->rollouts,
+            .seed = seed,
+            .pick = pick,
+            .taken = taken,
+            .config = draft_config,
+            .limits = limits
+        };
+    }
 
-	srand(time(NULL));
-    clock_t start_time_s = clock() / CLOCKS_PER_SEC;
-    if (start_time_s < 0)
+    // The calling thread does the work of the first worker so a single threaded
+    // search never spawns a thread.
+    int spawned = 1;
+    for (; spawned < num_threads; spawned++)
     {
+        if (pthread_create(&workers[spawned].thread, NULL, run_search_worker, &workers[spawned]) != 0)
+        {
+            fprintf(stderr, "Warning: Could only start %d search threads.\n", spawned);
+            break;
+        }
+    }
+    grow_tree(&workers[0]);
+    for (int i = 1; i < spawned; i++)
+        pthread_join(workers[i].thread, NULL);
+    destroy_pool(pool);
+
+    int num_trees = (shared_tree) ? 1 : spawned;
+    for (int i = 0; i < num_trees; i++)
+        RETAINED_ROOTS[i] = workers[i].root;
+    NUM_RETAINED = num_trees;
+    RETAINED_PICK = pick;
+}
+
+static const PlayerRecord* best_retained_pick(int pick)
+{
+    if (NUM_RETAINED == 0)
         return NULL;
+
+    // Merge the root children of every tree. Expansion is deterministic so child i
+    // of each root represents the same player. The merged score is the average of
+    // the trees' scores weighted by how many times each tree visited the child.
+	int team = team_with_pick(pick);
+	double max = 0.0;
+	const PlayerRecord* best = NULL;
+    // A root may not have allocated its extra children yet, those count as unvisited.
+    int r;
+    const NodeChunk* first_root = node_chunk(RETAINED_ROOTS[0], &r);
+	for (int i = 0; i < first_root->num_children[r]; i++)
+	{
+        const PlayerRecord* player = NULL;
+        int visited = 0;
+        double score_sum = 0.0;
+        for (int t = 0; t < NUM_RETAINED; t++)
+        {
+            int root_index, child_index;
+            const NodeChunk* root_chunk = node_chunk(RETAINED_ROOTS[t], &root_index);
+            assert(root_chunk->num_children[root_index] == first_root->num_children[r]);
+            NodeRef child = child_at(root_chunk, root_index, i);
+            if (child == NULL_NODE)
+                continue;
+            const NodeChunk* chunk = node_chunk(child, &child_index);
+            assert(!player || chunk->player_id[child_index] == player->id);
+            player = node_player(child);
+            visited += chunk->visited[child_index];
+            score_sum += chunk->score_sums[child_index * NUMBER_OF_TEAMS + team];
+        }
+        if (!player)
+            continue;
+
+        double score = (visited > 0) ? score_sum / visited : 0.0;
+		if (!best || score > max)
+		{
+			max = score;
+			best = player;
+		}
+	}
+
+    return best;
+}
+
+void advance_search_tree(const PlayerRecord* player)
+{
+    if (NUM_RETAINED == 0)
+        return;
+
+    // Copy the subtrees that are kept into the spare stores so the rest of the
+    // trees can be freed by resetting the active stores.
+    int kept = 0;
+    for (int i = 0; i < NUM_RETAINED; i++)
+    {
+        int r;
+        const NodeChunk* root = node_chunk(RETAINED_ROOTS[i], &r);
+        for (int j = 0; j < root->num_children[r]; j++)
+        {
+            NodeRef child = child_at(root, r, j);
+            if (child != NULL_NODE && node_player(child)->id == player->id)
+            {
+                NodeRef copy = copy_subtree(kept, child);
+                if (copy != NULL_NODE)
+                    RETAINED_ROOTS[kept++] = copy;
+                break;
+            }
+        }
+    }
+
+    for (int i = 0; i < MAX_THREADS; i++)
+        reset_node_store(&NODE_STORES[ACTIVE_STORES][i]);
+    ACTIVE_STORES = !ACTIVE_STORES;
+
+    NUM_RETAINED = kept;
+    RETAINED_PICK = (kept > 0) ? RETAINED_PICK + 1 : -1;
+    PONDERED_TIME = 0;
+}
+
+void reset_search_tree()
+{
+    for (int i = 0; i < MAX_THREADS; i++)
+    {
+        reset_node_store(&NODE_STORES[0][i]);
+        reset_node_store(&NODE_STORES[1][i]);
+    }
+    NUM_RETAINED = 0;
+    RETAINED_PICK = -1;
+    PONDERED_TIME = 0;
+    // The statistics of a state depend on the pick order and player pool, which may
+    // have changed.
+    clear_transpositions();
+}
+
+void free_search_memory()
+{
+    reset_search_tree();
+    for (int i = 0; i < MAX_THREADS; i++)
+    {
+        arena_destroy(&NODE_STORES[0][i].arena);
+        arena_destroy(&NODE_STORES[1][i].arena);
     }
+    resize_transpositions(0);
+    free(ZOBRIST_KEYS);
+    ZOBRIST_KEYS = NULL;
+    NUM_ZOBRIST_KEYS = 0;
+}
+
+static void* run_search_worker(void* arg)
+{
+    grow_tree((SearchWorker*)arg);
+    return NULL;
+}
 
-	// MASTER_CONTEXT reflects the real state of the draft i.e Actual current pick in the draft and
-	// actual taken players outside of this function.
-	SearchContext* MASTER_CONTEXT = create_search_context(pick, taken, draft_config);
-	SearchContext* current_context = create_search_context(pick, taken, draft_config);
+// Runs the select/expand/simulate/backpropogate loop on the worker's tree until the
+// worker's thinking time is up. Always runs at least one iteration so the root is
+// expanded by the time the trees get merged.
+static void grow_tree(SearchWorker* worker)
+{
+    const DraftConfig* draft_config = worker->config;
+    const int loss = (worker->shared_tree) ? VIRTUAL_LOSS : 0;
+
+	// The context starts out at the real state of the draft i.e Actual current pick in the draft and
+	// actual taken players outside of this function. Every iteration returns it to that state by
+	// undoing the picks made on the way down the tree.
+	SearchContext* current_context = create_search_context(worker->pick, worker->taken, draft_config);
+
+    // Scratch contexts for the rollouts are allocated once up front so the search loop itself
+    // never touches the heap except to grow the tree.
+    SearchContext* sim_contexts[worker->rollouts];
+    for (int i = 0; i < worker->rollouts; i++)
+    {
+        sim_contexts[i] = create_search_context(worker->pick, worker->taken, draft_config);
+        seed_rng(&sim_contexts[i]->rng, worker->seed, (uint64_t)worker->store * MAX_ROLLOUTS + i);
+    }
 
-    Node* root = create_node(NULL, NULL);
+    NodeRef root = worker->root;
+
+    // The nodes the current descent went through, starting at the root. Nodes don't
+    // know their parents, everything that has to go back up the tree walks the path.
+    NodeRef path[NUMBER_OF_PICKS - worker->pick + 2];
+    int length = 0;
 
-	MASTER_CONTEXT->node = root;
 	current_context->node = root;
     int max_depth = 0;
-    while ( (clock() / CLOCKS_PER_SEC) - start_time_s < thinking_time )
+    do
     {
-        Node* node = current_context->node;
+        NodeRef node = current_context->node;
 
-        // If node is NULL then that indicates we've searched the entire
+        // If node is NULL_NODE then that indicates we've searched the entire
         // search space, therefore we are done searching.
-        if (!node)
+        if (node == NULL_NODE)
             break;
 
-        node->visited++;
+        path[length++] = node;
+        int index;
+        NodeChunk* chunk = node_chunk(node, &index);
+        atomic_fetch_add_explicit(&chunk->visited[index], 1, memory_order_relaxed);
+        if (loss)
+            atomic_fetch_add_explicit(&chunk->virtual_loss[index], loss, memory_order_relaxed);
 
         if (is_leaf(node))
         {
-            expand_tree(node, current_context, draft_config);
-            if (node->parent != NULL) // We don't calculate score for root
+            int created = expand_tree(worker->store, node, current_context, draft_config);
+            atomic_fetch_add_explicit(&worker->limits->nodes, created, memory_order_relaxed);
+            atomic_fetch_add_explicit(&worker->limits->iterations, 1, memory_order_relaxed);
+            // A node that ends up expanded without children is the end of the draft (or the
+            // stores are full) and nothing will ever get added below it. num_children is only
+            // read once the acquire load has seen the expansion that wrote it.
+            if (created == 0 &&
+                    atomic_load_explicit(&chunk->expansion[index], memory_order_acquire) >= NODE_EXPANDED &&
+                    chunk->num_children[index] == 0)
+                mark_exhausted(path, length);
+            if (length > 1) // We don't calculate score for root
             {
-                double score = simulate_score(current_context, node, draft_config);
-                backpropogate_score(node, score, team_with_pick(current_context->pick)); 
+                double scores[NUMBER_OF_TEAMS];
+                simulate_batch(worker, current_context, sim_contexts, path, length, draft_config, scores);
+                backpropogate_score(path, length, scores); 
 
                 if (current_context->pick > max_depth)
                     max_depth = current_context->pick;
             }
-			reset_search_context_to(MASTER_CONTEXT, current_context);
+            if (loss)
+                apply_virtual_loss(path, length, -loss);
+            length = 0;
+            undo_picks(current_context, worker->pick);
+            current_context->node = root;
         }
         else
         {
             if (node != root) // root doesn't have a player associated to it
-                make_pick(current_context, node->chosen_player, draft_config);
+                make_pick(current_context, node_player(node), draft_config);
+            int created = widen_children(worker->store, node, current_context, draft_config);
+            if (created > 0)
+                atomic_fetch_add_explicit(&worker->limits->nodes, created, memory_order_relaxed);
 
             current_context->node = select_child(node, team_with_pick(current_context->pick));
         }
-    } 
+    } while (!is_search_over(worker));
 
-    // Find player with highest score
-	double max = 0.0;
-	int child = 0;
-	int team = team_with_pick(pick);
-	for (int i = 0; i < NUMBER_OF_SLOTS; i++)
-	{
-		if (root->children[i] && root->children[i]->scores[team] > max)
-		{
-			max = root->children[i]->scores[team];
-			child = i;
-		}
-	}
-    if (root->children[child] == NULL) 
+    // The search ended in the middle of a descent. Take back the virtual loss of the
+    // nodes that were already visited.
+    if (loss)
+        apply_virtual_loss(path, length, -loss);
+
+    destroy_search_context(current_context);
+    for (int i = 0; i < worker->rollouts; i++)
+        destroy_search_context(sim_contexts[i]);
+}
+
+static void simulate_batch(
+        const SearchWorker* worker, 
+        const SearchContext* context, 
+        SearchContext** sim_contexts, 
+        const NodeRef path[],
+        int length,
+        const DraftConfig* config,
+        double scores[])
+{
+    double rollout_scores[worker->rollouts * NUMBER_OF_TEAMS];
+    RolloutBatch batch = {
+        .context = context,
+        .sim_contexts = sim_contexts,
+        .path = path,
+        .length = length,
+        .root_pick = worker->pick,
+        .config = config,
+        .scores = rollout_scores
+    };
+
+    if (worker->pool)
     {
-        destroy_search_context(MASTER_CONTEXT);
-        destroy_search_context(current_context);
-        free_node(root);
-        return NULL;
+        pool_run(worker->pool, run_rollout, &batch, worker->rollouts);
+    }
+    else
+    {
+        for (int i = 0; i < worker->rollouts; i++)
+            run_rollout(&batch, i);
+    }
+
+    for (int team = 0; team < NUMBER_OF_TEAMS; team++)
+    {
+        double total = 0.0;
+        for (int i = 0; i < worker->rollouts; i++)
+            total += rollout_scores[i * NUMBER_OF_TEAMS + team];
+        scores[team] = total / worker->rollouts;
+    }
+}
+
+// Every rollout of a batch gets its own scratch context, so the rollouts can run in parallel.
+static void run_rollout(void* arg, int index)
+{
+    RolloutBatch* batch = arg;
+    SearchContext* sim_context = batch->sim_contexts[index];
+    reset_search_context_to(batch->context, sim_context);
+    simulate_score(sim_context, batch->path[batch->length - 1], batch->config, &batch->scores[index * NUMBER_OF_TEAMS]);
+    if (RAVE_EQUIVALENCE > 0)
+        update_amaf(batch->path, batch->length, sim_context, batch->root_pick);
+}
+
+static bool is_search_over(const SearchWorker* worker)
+{
+    const SearchLimits* limits = worker->limits;
+    if (limits->stop && atomic_load_explicit(limits->stop, memory_order_relaxed))
+        return true;
+    int r;
+    const NodeChunk* root = node_chunk(worker->root, &r);
+    if (atomic_load_explicit(&root->expansion[r], memory_order_acquire) == NODE_EXHAUSTED)
+        return true;
+    if (limits->max_nodes > 0 && 
+        atomic_load_explicit(&limits->nodes, memory_order_relaxed) >= limits->max_nodes)
+        return true;
+    if (limits->max_iterations > 0 &&
+        atomic_load_explicit(&limits->iterations, memory_order_relaxed) >= limits->max_iterations)
+        return true;
+    // Wall clock time is used rather than clock() because clock() measures the
+    // cpu time of the whole process, which runs num_threads times faster than
+    // real time when searching in parallel.
+    return limits->deadline >= 0 && now_ms() >= limits->deadline;
+}
+
+static long search_space_size(int pick, int widening, long limit, const DraftConfig* config)
+{
+    // Every node has at most widening children per slot.
+    long branching = (long)config->num_slots * widening;
+    long size = 0;
+    long level = 1;
+    for (int p = pick; p < get_number_of_picks(config) && size < limit; p++)
+    {
+        level = (level > limit / branching) ? limit : level * branching;
+        size += level;
+    }
+    return (size < limit) ? size : limit;
+}
+
+static long long now_ms()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static NodeRef create_nodes(int set, int store_index, int count)
+{
+    NodeStore* store = &NODE_STORES[set][store_index];
+    uint32_t first = store->size;
+    // Child blocks never straddle two chunks so they can be read with one chunk lookup.
+    if ((first & (NODE_CHUNK_SIZE - 1)) + count > NODE_CHUNK_SIZE)
+        first = (first + NODE_CHUNK_SIZE - 1) & ~(uint32_t)(NODE_CHUNK_SIZE - 1);
+    if (first + count >= (1u << NODE_INDEX_BITS))
+        return NULL_NODE;
+
+    int chunk = first >> NODE_CHUNK_BITS;
+    if ((first & (NODE_CHUNK_SIZE - 1)) == 0)
+    {
+        size_t size = sizeof(NodeChunk) + NODE_CHUNK_SIZE * NUMBER_OF_TEAMS * sizeof(_Atomic double);
+        size_t hash_offset = size;
+        if (NODE_HASHES)
+            size += NODE_CHUNK_SIZE * sizeof(uint64_t);
+        size_t amaf_offset = size;
+        if (RAVE_EQUIVALENCE > 0)
+            size += NODE_CHUNK_SIZE * (sizeof(atomic_int) + sizeof(_Atomic double));
+
+        char* memory = arena_alloc(&store->arena, size);
+        if (!memory)
+            return NULL_NODE;
+        NodeChunk* new_chunk = (NodeChunk*)memory;
+        new_chunk->hash = (NODE_HASHES) ? (uint64_t*)(memory + hash_offset) : NULL;
+        new_chunk->amaf_visits = NULL;
+        new_chunk->amaf_sums = NULL;
+        if (RAVE_EQUIVALENCE > 0)
+        {
+            new_chunk->amaf_visits = (atomic_int*)(memory + amaf_offset);
+            new_chunk->amaf_sums = (_Atomic double*)(memory + amaf_offset + NODE_CHUNK_SIZE * sizeof(atomic_int));
+        }
+        store->chunks[chunk] = new_chunk;
     }
 
-    const PlayerRecord* chosen_player = get_player_by_id(root->children[child]->chosen_player->id);
+    store->size = first + count;
+    return ((NodeRef)store_index << NODE_INDEX_BITS) | first;
+}
 
-	destroy_search_context(MASTER_CONTEXT);
-	destroy_search_context(current_context);
+static void init_node(int set, NodeRef node, uint16_t player_id, uint64_t hash)
+{
+    int i;
+    NodeChunk* chunk = node_chunk_in(set, node, &i);
+
+    atomic_init(&chunk->visited[i], 0);
+    atomic_init(&chunk->virtual_loss[i], 0);
+    atomic_init(&chunk->expansion[i], NODE_UNEXPANDED);
+    chunk->first_child[i] = NULL_NODE;
+    atomic_init(&chunk->extra_child[i], NULL_NODE);
+    chunk->num_children[i] = 0;
+    chunk->num_initial[i] = 0;
+    chunk->player_id[i] = player_id;
+    if (chunk->hash)
+        chunk->hash[i] = hash;
+    if (chunk->amaf_visits)
+    {
+        atomic_init(&chunk->amaf_visits[i], 0);
+        atomic_init(&chunk->amaf_sums[i], 0.0);
+    }
 
-	free_node(root);
+	for (int team = 0; team < NUMBER_OF_TEAMS; team++) 
+    	atomic_init(&chunk->score_sums[i * NUMBER_OF_TEAMS + team], 0.0);
+}
+
+static void reset_node_store(NodeStore* store)
+{
+    arena_reset(&store->arena);
+    store->size = 0;
+}
 
-    return chosen_player;
+static NodeChunk* node_chunk_in(int set, NodeRef node, int* index)
+{
+    const NodeStore* store = &NODE_STORES[set][node >> NODE_INDEX_BITS];
+    uint32_t i = node & ((1u << NODE_INDEX_BITS) - 1);
+    *index = i & (NODE_CHUNK_SIZE - 1);
+    return store->chunks[i >> NODE_CHUNK_BITS];
 }
 
-static Node* create_node(Node* parent, const PlayerRecord* chosen_player)
+static NodeChunk* node_chunk(NodeRef node, int* index)
 {
-    Node* node = malloc(sizeof(Node) + NUMBER_OF_SLOTS * sizeof(Node*));
+    return node_chunk_in(ACTIVE_STORES, node, index);
+}
 
-    node->parent = parent;
-    node->visited = 0;
-    node->chosen_player = chosen_player;
-    node->scores = malloc(sizeof(double) * NUMBER_OF_TEAMS);
+static const PlayerRecord* node_player(NodeRef node)
+{
+    int i;
+    uint16_t id = node_chunk(node, &i)->player_id[i];
+    return (id != NO_PLAYER) ? get_player_by_id(id) : NULL;
+}
 
-	for (int i = 0; i < NUMBER_OF_TEAMS; i++) 
-    	node->scores[i] = 0.0;
-    for (int i = 0; i < NUMBER_OF_SLOTS; i++)
-        node->children[i] = NULL;
+static uint64_t node_hash(const NodeChunk* chunk, int i)
+{
+    return (chunk->hash) ? chunk->hash[i] : 0;
+}
 
-    return node;
+// Only called between searches, so nothing is modifying the tree while it's copied.
+static NodeRef copy_subtree(int store, NodeRef node)
+{
+    NodeRef copy = create_nodes(!ACTIVE_STORES, store, 1);
+    if (copy == NULL_NODE)
+        return NULL_NODE;
+
+    int from;
+    const NodeChunk* from_chunk = node_chunk(node, &from);
+    // The copy becomes a root. Its pick has been made in the real draft by now, so like any
+    // other root it doesn't have a player associated to it.
+    init_node(!ACTIVE_STORES, copy, NO_PLAYER, node_hash(from_chunk, from));
+    copy_children(store, node, copy);
+    return copy;
 }
 
-static void free_node(Node* node)
+// Copies the statistics of node into copy, which is already initialized, and then
+// does the same for all of node's descendants.
+static void copy_children(int store, NodeRef node, NodeRef copy)
 {
-	if (!node)
-		return;
+    int from, to;
+    const NodeChunk* from_chunk = node_chunk(node, &from);
+    NodeChunk* to_chunk = node_chunk_in(!ACTIVE_STORES, copy, &to);
+
+    atomic_init(&to_chunk->visited[to], from_chunk->visited[from]);
+    atomic_init(&to_chunk->expansion[to], from_chunk->expansion[from]);
+    if (to_chunk->amaf_visits)
+    {
+        atomic_init(&to_chunk->amaf_visits[to], from_chunk->amaf_visits[from]);
+        atomic_init(&to_chunk->amaf_sums[to], from_chunk->amaf_sums[from]);
+    }
+	for (int team = 0; team < NUMBER_OF_TEAMS; team++) 
+    {
+    	atomic_init(
+                &to_chunk->score_sums[to * NUMBER_OF_TEAMS + team], 
+                from_chunk->score_sums[from * NUMBER_OF_TEAMS + team]);
+    }
 
-    free(node->scores);
+    NodeRef from_blocks[2];
+    int sizes[2];
+    int num_blocks = child_blocks(from_chunk, from, from_blocks, sizes);
+    if (num_blocks == 0)
+        return;
 
-    for (int i = 0; i < NUMBER_OF_SLOTS; i++)
-        free_node(node->children[i]);
+    NodeRef to_blocks[2] = { NULL_NODE, NULL_NODE };
+    for (int b = 0; b < num_blocks; b++)
+    {
+        to_blocks[b] = create_nodes(!ACTIVE_STORES, store, sizes[b]);
+        if (to_blocks[b] == NULL_NODE)
+        {
+            // Out of memory. Without its initial children the copy becomes a leaf that
+            // gets expanded again. Without the rest they get allocated again.
+            if (b == 0)
+            {
+                atomic_init(&to_chunk->expansion[to], NODE_UNEXPANDED);
+                return;
+            }
+            break;
+        }
 
-    free(node);
+        for (int i = 0; i < sizes[b]; i++)
+        {
+            int c;
+            const NodeChunk* child_chunk = node_chunk(from_blocks[b] + i, &c);
+            init_node(!ACTIVE_STORES, to_blocks[b] + i, child_chunk->player_id[c], node_hash(child_chunk, c));
+            copy_children(store, from_blocks[b] + i, to_blocks[b] + i);
+        }
+    }
+    to_chunk->first_child[to] = to_blocks[0];
+    atomic_init(&to_chunk->extra_child[to], to_blocks[1]);
+    to_chunk->num_children[to] = from_chunk->num_children[from];
+    to_chunk->num_initial[to] = from_chunk->num_initial[from];
+    // An exhausted node whose extra children couldn't be copied has room to grow again.
+    if (to_blocks[1] == NULL_NODE && to_chunk->num_children[to] > to_chunk->num_initial[to])
+        atomic_init(&to_chunk->expansion[to], NODE_EXPANDED);
+}
+
+// splitmix64. Only used to fill the key table and seed the rollout generators, so it
+// doesn't need to be fast.
+static uint64_t splitmix64(uint64_t* state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static void seed_rng(Rng* rng, uint64_t seed, uint64_t stream)
+{
+    uint64_t state = seed ^ splitmix64(&stream);
+    for (int i = 0; i < 4; i++)
+        rng->s[i] = splitmix64(&state);
+}
+
+static uint64_t rotate_left(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+static uint64_t next_random(Rng* rng)
+{
+    uint64_t* s = rng->s;
+    uint64_t result = rotate_left(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotate_left(s[3], 45);
+    return result;
+}
+
+static void init_zobrist_keys()
+{
+    int num_keys = number_of_players * NUMBER_OF_TEAMS;
+    if (num_keys == NUM_ZOBRIST_KEYS)
+        return;
+
+    uint64_t* keys = realloc(ZOBRIST_KEYS, sizeof(uint64_t) * num_keys);
+    assert(keys != NULL);
+    uint64_t state = 0;
+    ZOBRIST_BASE = splitmix64(&state);
+    for (int i = 0; i < num_keys; i++)
+        keys[i] = splitmix64(&state);
+    ZOBRIST_KEYS = keys;
+    NUM_ZOBRIST_KEYS = num_keys;
+}
+
+static uint64_t zobrist_key(unsigned int player_id, int team)
+{
+    return ZOBRIST_KEYS[player_id * NUMBER_OF_TEAMS + team];
+}
+
+static uint64_t hash_taken(const Taken taken[], int pick)
+{
+    uint64_t hash = ZOBRIST_BASE;
+    for (int i = 0; i < pick; i++)
+        hash ^= zobrist_key(taken[i].player_id, taken[i].by_team);
+    return hash;
+}
+
+static void resize_transpositions(long entries)
+{
+    size_t num_buckets = 0;
+    while (entries > 0 && (num_buckets * 2) * TRANSPOSITION_BUCKET_SIZE <= (size_t)entries)
+        num_buckets = (num_buckets) ? num_buckets * 2 : 1;
+
+    if (num_buckets == TRANSPOSITIONS.num_buckets && NUMBER_OF_TEAMS == TRANSPOSITIONS.teams)
+        return;
+
+    free(TRANSPOSITIONS.entries);
+    TRANSPOSITIONS.entries = NULL;
+    TRANSPOSITIONS.num_buckets = 0;
+    TRANSPOSITIONS.teams = NUMBER_OF_TEAMS;
+    TRANSPOSITIONS.entry_size = sizeof(TranspositionEntry) + NUMBER_OF_TEAMS * sizeof(_Atomic double);
+    if (num_buckets == 0)
+        return;
+
+    // All bits zero is an empty entry.
+    TRANSPOSITIONS.entries = calloc(num_buckets * TRANSPOSITION_BUCKET_SIZE, TRANSPOSITIONS.entry_size);
+    if (!TRANSPOSITIONS.entries)
+    {
+        fprintf(stderr, "Warning: Out of memory for the transposition table. Searching without it.\n");
+        return;
+    }
+    TRANSPOSITIONS.num_buckets = num_buckets;
+}
+
+static void clear_transpositions()
+{
+    if (TRANSPOSITIONS.entries)
+    {
+        memset(TRANSPOSITIONS.entries, 0, 
+                TRANSPOSITIONS.num_buckets * TRANSPOSITION_BUCKET_SIZE * TRANSPOSITIONS.entry_size);
+    }
+}
+
+static TranspositionEntry* transposition_entry(size_t bucket, int i)
+{
+    size_t index = bucket * TRANSPOSITION_BUCKET_SIZE + i;
+    return (TranspositionEntry*)(TRANSPOSITIONS.entries + index * TRANSPOSITIONS.entry_size);
+}
+
+static const TranspositionEntry* probe_transposition(uint64_t hash)
+{
+    if (TRANSPOSITIONS.num_buckets == 0)
+        return NULL;
+
+    size_t bucket = hash & (TRANSPOSITIONS.num_buckets - 1);
+    for (int i = 0; i < TRANSPOSITION_BUCKET_SIZE; i++)
+    {
+        const TranspositionEntry* entry = transposition_entry(bucket, i);
+        if (atomic_load_explicit(&entry->hash, memory_order_relaxed) == hash)
+            return entry;
+    }
+    return NULL;
+}
+
+static void store_transposition(uint64_t hash, const double scores[])
+{
+    if (TRANSPOSITIONS.num_buckets == 0)
+        return;
+
+    size_t bucket = hash & (TRANSPOSITIONS.num_buckets - 1);
+    TranspositionEntry* entry = NULL;
+    TranspositionEntry* victim = NULL;
+    int fewest_visits = 0;
+    for (int i = 0; i < TRANSPOSITION_BUCKET_SIZE; i++)
+    {
+        TranspositionEntry* candidate = transposition_entry(bucket, i);
+        if (atomic_load_explicit(&candidate->hash, memory_order_relaxed) == hash)
+        {
+            entry = candidate;
+            break;
+        }
+        int visits = atomic_load_explicit(&candidate->visited, memory_order_relaxed);
+        if (!victim || visits < fewest_visits)
+        {
+            victim = candidate;
+            fewest_visits = visits;
+        }
+    }
+
+    if (!entry)
+    {
+        unsigned long long old_hash = atomic_load_explicit(&victim->hash, memory_order_relaxed);
+        if (atomic_compare_exchange_strong(&victim->hash, &old_hash, hash))
+        {
+            atomic_store_explicit(&victim->visited, 0, memory_order_relaxed);
+            for (int i = 0; i < TRANSPOSITIONS.teams; i++)
+                atomic_store_explicit(&victim->score_sums[i], 0.0, memory_order_relaxed);
+        }
+        // Another thread may have claimed the entry first. If it was for the same state
+        // the score still goes in, otherwise it is dropped.
+        if (atomic_load_explicit(&victim->hash, memory_order_relaxed) != hash)
+            return;
+        entry = victim;
+    }
+
+    atomic_fetch_add_explicit(&entry->visited, 1, memory_order_relaxed);
+    for (int i = 0; i < TRANSPOSITIONS.teams; i++)
+        atomic_add_double(&entry->score_sums[i], scores[i]);
 }
 
 static SearchContext* create_search_context(int pick, const Taken* taken, const DraftConfig* config)
 {
-	SearchContext* context = malloc(sizeof(SearchContext) + sizeof(int*) * NUMBER_OF_TEAMS);
-	context->node = NULL;
+	SearchContext* context = malloc(sizeof(SearchContext) + sizeof(SlotCounts) * NUMBER_OF_TEAMS);
+	context->node = NULL_NODE;
 	context->pick = pick;
     context->taken = malloc(sizeof(Taken) * NUMBER_OF_PICKS);
 	memcpy(context->taken, taken, NUMBER_OF_PICKS * sizeof(Taken));
+    context->hash = hash_taken(taken, pick);
+    init_availability(&context->available, taken, pick);
+    init_position_cursors(&context->cursors, &context->available, config);
+    init_pool_stats(&context->pool, &context->available);
+    seed_rng(&context->rng, 0, 0);
+    context->filled_slots = malloc(sizeof(int) * NUMBER_OF_PICKS);
+    context->team_points = calloc(NUMBER_OF_TEAMS, sizeof(double));
+    context->prior_points = malloc(sizeof(double) * NUMBER_OF_PICKS);
+    context->prior_pool = malloc(sizeof(PoolSums) * NUMBER_OF_PICKS);
 	for (int i = 0; i < NUMBER_OF_TEAMS; i++)
-	{
-        context->team_requirements[i] = malloc(sizeof(int) * NUMBER_OF_SLOTS);
-		for (int j = 0; j < NUMBER_OF_SLOTS; j++)
-		{
-			context->team_requirements[i][j] = config->slots[j].num_required;
-		}
-	}
+        context->team_requirements[i] = config->roster;
 	// Loop through taken and mark off those players from team_requirements
 	for (int i = 0; i < pick; i++) 
 	{
 		Taken t = taken[i];
 		const PlayerRecord* player = get_player_by_id(t.player_id);
-		fill_slot(context, player, t.by_team, config);
+		context->filled_slots[i] = fill_slot(context, player, t.by_team, config);
 	}
 	
 	return context;
@@ -266,8 +1406,10 @@ static SearchContext* create_search_context(int pick, const Taken* taken, const
 static void destroy_search_context(SearchContext* context)
 {
 	free(context->taken);
-	for (int i = 0; i < NUMBER_OF_TEAMS; i++)
-		free(context->team_requirements[i]);
+    free(context->filled_slots);
+    free(context->team_points);
+    free(context->prior_points);
+    free(context->prior_pool);
 	free(context);
 }
 
@@ -275,86 +1417,236 @@ static void reset_search_context_to(const SearchContext* original, SearchContext
 {
 	delta->node = original->node;
 	delta->pick = original->pick;
-	memcpy(delta->taken, original->taken, NUMBER_OF_PICKS * sizeof(Taken));
-	for (int i = 0; i < NUMBER_OF_TEAMS; i++)
-		memcpy(delta->team_requirements[i], original->team_requirements[i], NUMBER_OF_SLOTS * sizeof(int));
+    // Entries past the current pick are never read, so only the picks made so far are copied.
+	memcpy(delta->taken, original->taken, original->pick * sizeof(Taken));
+    delta->hash = original->hash;
+    delta->available = original->available;
+    delta->cursors = original->cursors;
+    delta->pool = original->pool;
+    memcpy(delta->filled_slots, original->filled_slots, original->pick * sizeof(int));
+    memcpy(delta->team_points, original->team_points, NUMBER_OF_TEAMS * sizeof(double));
+    memcpy(delta->prior_points, original->prior_points, original->pick * sizeof(double));
+    memcpy(delta->prior_pool, original->prior_pool, original->pick * sizeof(PoolSums));
+    memcpy(delta->team_requirements, original->team_requirements, NUMBER_OF_TEAMS * sizeof(SlotCounts));
 }
 
-static Node* select_child(const Node* parent, int team)
+static void undo_picks(SearchContext* context, int pick)
 {
-	assert(parent != NULL);
-	Node* max_score_node = NULL;
+    while (context->pick > pick)
+    {
+        context->pick--;
+        const PlayerRecord* player = get_player_by_id(context->taken[context->pick].player_id);
+        context->hash ^= zobrist_key(player->id, context->taken[context->pick].by_team);
+        mark_available(&context->available, player->id);
+        rewind_position_cursor(&context->cursors, player);
+        return_to_pool(&context->pool, player, &context->prior_pool[context->pick]);
+        int slot = context->filled_slots[context->pick];
+        if (slot >= 0)
+            release_slot_count(&context->team_requirements[context->taken[context->pick].by_team], slot);
+        // Restored rather than subtracted so the sums don't drift over millions of undos.
+        context->team_points[context->taken[context->pick].by_team] = context->prior_points[context->pick];
+    }
+}
+
+static NodeRef select_child(NodeRef parent, int team)
+{
+	assert(parent != NULL_NODE);
+    int p, c;
+    const NodeChunk* parent_chunk = node_chunk(parent, &p);
+    int num_children = parent_chunk->num_children[p];
+    if (num_children == 0)
+        return NULL_NODE;
+
+    int parent_visits = effective_visits(parent);
+    int open = num_open_children(parent_chunk, p, parent_visits);
+    NodeRef blocks[2];
+    int sizes[2];
+    int num_blocks = child_blocks(parent_chunk, p, blocks, sizes);
+    double exploration = 2 * sqrt_log(parent_visits);
+
+	NodeRef max_score_node = NULL_NODE;
 	double max_score = 0.0;
-	for (int i = 0; i < NUMBER_OF_SLOTS; i++) 
-	{
-		Node* child = parent->children[i];
-		if (!child) 
-			continue;
+    for (int b = 0; b < num_blocks && open > 0; b++)
+    {
+        const NodeChunk* chunk = node_chunk(blocks[b], &c);
+        int size = (sizes[b] < open) ? sizes[b] : open;
+        open -= size;
+        for (int i = 0; i < size; i++) 
+        {
+            int visits = atomic_load_explicit(&chunk->visited[c + i], memory_order_relaxed) +
+                atomic_load_explicit(&chunk->virtual_loss[c + i], memory_order_relaxed);
+            if (visits == 0) 
+                return blocks[b] + i;
 
-		if (child->visited == 0) 
-		{
-			max_score_node = child;
-			break;
-		}
-		double score = calculate_ucb(child, team);
-		if (score > max_score)
-		{
-			max_score = score;
-			max_score_node = child;
-		}
-	}
+            double score = calculate_ucb(chunk, c + i, visits, exploration, team);
+            if (max_score_node == NULL_NODE || score > max_score)
+            {
+                max_score = score;
+                max_score_node = blocks[b] + i;
+            }
+        }
+    }
 	return max_score_node;
 }
 
-static double calculate_ucb(const Node* node, int team)
+static double calculate_ucb(const NodeChunk* chunk, int i, int visits, double exploration, int team)
 {
-	assert(node != NULL);
-	double total = 0.0;
-	for (int i = 0; i < NUMBER_OF_SLOTS; i++) 
-	{
-		const Node* child = node->children[i];
-		if (child)
-			total += child->scores[team];
-	}
-	double mean_score = total / NUMBER_OF_SLOTS;
-	return mean_score + 2 * sqrt(log(node->parent->visited) / node->visited);
+    // Every rollout through the node adds to the node's own score sums, so its mean is
+    // one division away.
+	double mean_score = state_score(chunk, i, team);
+
+    // RAVE blends in the AMAF score with a weight that fades as the node gets visits
+    // of its own: beta = sqrt(k / (3 * visits + k)).
+    int amaf_visits = (RAVE_EQUIVALENCE > 0) ? 
+        atomic_load_explicit(&chunk->amaf_visits[i], memory_order_relaxed) : 0;
+    if (amaf_visits > 0)
+    {
+        double amaf_score = atomic_load_explicit(&chunk->amaf_sums[i], memory_order_relaxed) / amaf_visits;
+        double beta = sqrt((double)RAVE_EQUIVALENCE / (3.0 * visits + RAVE_EQUIVALENCE));
+        mean_score = (1.0 - beta) * mean_score + beta * amaf_score;
+    }
+	return mean_score + exploration * inv_sqrt(visits);
+}
+
+static void init_ucb_tables()
+{
+    SQRT_LOG_TABLE[0] = 0.0;
+    INV_SQRT_TABLE[0] = 0.0;
+    for (int v = 1; v < UCB_TABLE_SIZE; v++)
+    {
+        SQRT_LOG_TABLE[v] = sqrt(log(v));
+        INV_SQRT_TABLE[v] = 1.0 / sqrt(v);
+    }
+}
+
+static double sqrt_log(int visits)
+{
+    return (visits < UCB_TABLE_SIZE) ? SQRT_LOG_TABLE[visits] : sqrt(log(visits));
+}
+
+static double inv_sqrt(int visits)
+{
+    return (visits < UCB_TABLE_SIZE) ? INV_SQRT_TABLE[visits] : 1.0 / sqrt(visits);
+}
+
+static double state_score(const NodeChunk* chunk, int i, int team)
+{
+    const TranspositionEntry* entry = (chunk->hash) ? probe_transposition(chunk->hash[i]) : NULL;
+    if (entry)
+    {
+        int visits = atomic_load_explicit(&entry->visited, memory_order_relaxed);
+        if (visits > 0)
+            return atomic_load_explicit(&entry->score_sums[team], memory_order_relaxed) / visits;
+    }
+
+    int visits = atomic_load_explicit(&chunk->visited[i], memory_order_relaxed) +
+        atomic_load_explicit(&chunk->virtual_loss[i], memory_order_relaxed);
+    if (visits == 0)
+        return 0.0;
+    return atomic_load_explicit(&chunk->score_sums[i * NUMBER_OF_TEAMS + team], memory_order_relaxed) / visits;
+}
+
+// A node that is still being expanded by another thread is treated as a leaf.
+static bool is_leaf(NodeRef node)
+{
+	assert(node != NULL_NODE);
+    int i;
+    const NodeChunk* chunk = node_chunk(node, &i);
+    if (atomic_load_explicit(&chunk->expansion[i], memory_order_acquire) < NODE_EXPANDED)
+        return true;
+    return chunk->num_children[i] == 0;
+}
+
+static int num_open_children(const NodeChunk* chunk, int i, int visits)
+{
+    int widened = chunk->num_initial[i] + (int)(WIDENING_RATE * visits * inv_sqrt(visits));
+    return (widened < chunk->num_children[i]) ? widened : chunk->num_children[i];
+}
+
+static int child_blocks(const NodeChunk* chunk, int i, NodeRef blocks[2], int sizes[2])
+{
+    if (chunk->num_children[i] == 0)
+        return 0;
+    blocks[0] = chunk->first_child[i];
+    sizes[0] = chunk->num_initial[i];
+
+    NodeRef extra = atomic_load_explicit(&chunk->extra_child[i], memory_order_acquire);
+    if (extra == NULL_NODE || extra == PENDING_NODE)
+        return 1;
+    blocks[1] = extra;
+    sizes[1] = chunk->num_children[i] - chunk->num_initial[i];
+    return 2;
 }
 
-static bool is_leaf(const Node* node)
+static NodeRef child_at(const NodeChunk* chunk, int i, int child)
 {
-	assert(node != NULL);
-    for (int i = 0; i < NUMBER_OF_SLOTS; i++)
+    NodeRef blocks[2];
+    int sizes[2];
+    int num_blocks = child_blocks(chunk, i, blocks, sizes);
+    for (int b = 0; b < num_blocks; b++)
     {
-        if (node->children[i])
+        if (child < sizes[b])
+            return blocks[b] + child;
+        child -= sizes[b];
+    }
+    return NULL_NODE;
+}
+
+static void mark_exhausted(const NodeRef path[], int length)
+{
+    int n;
+    NodeChunk* chunk = node_chunk(path[length - 1], &n);
+    atomic_store_explicit(&chunk->expansion[n], NODE_EXHAUSTED, memory_order_release);
+
+    for (int k = length - 2; k >= 0; k--)
+    {
+        chunk = node_chunk(path[k], &n);
+        if (num_open_children(chunk, n, effective_visits(path[k])) < chunk->num_children[n])
+            return;
+
+        NodeRef blocks[2];
+        int sizes[2];
+        int num_blocks = child_blocks(chunk, n, blocks, sizes);
+        int allocated = 0;
+        for (int b = 0; b < num_blocks; b++)
         {
-            return false;
+            int c;
+            const NodeChunk* children = node_chunk(blocks[b], &c);
+            for (int i = c; i < c + sizes[b]; i++)
+            {
+                if (atomic_load_explicit(&children->expansion[i], memory_order_acquire) != NODE_EXHAUSTED)
+                    return;
+            }
+            allocated += sizes[b];
         }
+        if (allocated < chunk->num_children[n])
+            return;
+        atomic_store_explicit(&chunk->expansion[n], NODE_EXHAUSTED, memory_order_release);
     }
-    return true;
 }
 
-static void fill_slot(SearchContext* context, const PlayerRecord* player, int team, const DraftConfig* config)
+static int effective_visits(NodeRef node)
 {
-	if (context->team_requirements[team][player->position] > 0)
-	{
-		context->team_requirements[team][player->position]--;
-	}
-	// Decrement first available flex position that fits this player's position
-	else
-	{
-		for (int j = 0; j < NUMBER_OF_SLOTS; j++)
-		{
-			if (
-				is_flex_slot(&config->slots[j]) && 
-				context->team_requirements[team][j] > 0 &&
-				flex_includes_position(&config->slots[j], player->position)
-			   )
-			{
-				context->team_requirements[team][j]--;
-                break; // don't wanna fill up multiple flex's if possible
-			}
-		}
-	}
+    int i;
+    NodeChunk* chunk = node_chunk(node, &i);
+    return atomic_load_explicit(&chunk->visited[i], memory_order_relaxed) + 
+        atomic_load_explicit(&chunk->virtual_loss[i], memory_order_relaxed);
+}
+
+// Adds loss to the virtual loss of every node on the path.
+static void apply_virtual_loss(const NodeRef path[], int length, int loss)
+{
+    for (int k = 0; k < length; k++)
+    {
+        int i;
+        NodeChunk* chunk = node_chunk(path[k], &i);
+        atomic_fetch_add_explicit(&chunk->virtual_loss[i], loss, memory_order_relaxed);
+    }
+}
+
+static int fill_slot(SearchContext* context, const PlayerRecord* player, int team, const DraftConfig* config)
+{
+    return fill_slot_counts(config, &context->team_requirements[team], player->position);
 }
 
 static void make_pick(SearchContext* context, const PlayerRecord* player, const DraftConfig* config)
@@ -363,118 +1655,211 @@ static void make_pick(SearchContext* context, const PlayerRecord* player, const
 	int team = team_with_pick(context->pick);
 	context->taken[context->pick].player_id = player->id;
 	context->taken[context->pick].by_team = team;
+    context->hash ^= zobrist_key(player->id, team);
+    mark_taken(&context->available, player->id);
+    advance_position_cursor(&context->cursors, player, &context->available);
+    remove_from_pool(&context->pool, player, &context->prior_pool[context->pick]);
+	context->filled_slots[context->pick] = fill_slot(context, player, team, config);
+    context->prior_points[context->pick] = context->team_points[team];
+    context->team_points[team] += player->projected_points;
+    context->pick++;
+}
+
+static void make_rollout_pick(SearchContext* context, const PlayerRecord* player, const DraftConfig* config)
+{
+	int team = team_with_pick(context->pick);
+	context->taken[context->pick].player_id = player->id;
+	context->taken[context->pick].by_team = team;
+    mark_taken(&context->available, player->id);
+    advance_position_cursor(&context->cursors, player, &context->available);
+    remove_from_pool(&context->pool, player, NULL);
 	fill_slot(context, player, team, config);
+    context->team_points[team] += player->projected_points;
     context->pick++;
 }
 
-static void expand_tree(Node* const node, const SearchContext* context, const DraftConfig* config)
+static int expand_tree(int store, NodeRef node, SearchContext* context, const DraftConfig* config)
 {
-	assert(node != NULL);
+	assert(node != NULL_NODE);
+
+    int n;
+    NodeChunk* chunk = node_chunk(node, &n);
+    unsigned char expected = NODE_UNEXPANDED;
+    if (!atomic_compare_exchange_strong(&chunk->expansion[n], &expected, NODE_EXPANDING))
+        return 0;
 
     // next tree level is for *next* pick.
 	// Need to add the node we are coming from to the pick history. Ran into a bug where the team
     // that drafted back-to-back in the snake draft was thinking that the player in the from_node was
-    // still available to be picked. Here we copy the search_context and then expand.
-    SearchContext* expand_context = create_search_context(context->pick, context->taken, config);
-    reset_search_context_to(context, expand_context);
-    if (node->chosen_player)
-        make_pick(expand_context, node->chosen_player, config);
+    // still available to be picked. Here we make the node's pick in the context and undo it once
+    // we have expanded.
+    int pick = context->pick;
+    const PlayerRecord* chosen_player = node_player(node);
+    if (chosen_player)
+        make_pick(context, chosen_player, config);
+
+    const PlayerRecord* players[NUMBER_OF_SLOTS * WIDENING];
+    uint64_t hashes[NUMBER_OF_SLOTS * WIDENING];
+    int initial;
+    int count = list_children(context, config, players, hashes, &initial);
+    undo_picks(context, pick);
+
+    // Only the initial children are allocated now. If that fails the node is left a leaf
+    // without children.
+    NodeRef first_child = (count > 0) ? create_nodes(ACTIVE_STORES, store, initial) : NULL_NODE;
+    if (first_child == NULL_NODE)
+        count = initial = 0;
+    for (int i = 0; i < initial; i++)
+        init_node(ACTIVE_STORES, first_child + i, players[i]->id, hashes[i]);
+    chunk->first_child[n] = first_child;
+    chunk->num_children[n] = count;
+    chunk->num_initial[n] = initial;
+
+    // Publishes the children to the other threads.
+    atomic_store_explicit(&chunk->expansion[n], NODE_EXPANDED, memory_order_release);
+    return initial;
+}
 
-    if (expand_context->pick >= NUMBER_OF_PICKS) 
+static int list_children(
+        const SearchContext* context, 
+        const DraftConfig* config, 
+        const PlayerRecord* players[], 
+        uint64_t hashes[], 
+        int* initial)
+{
+    // The children are the WIDENING best available players of every slot the team still
+    // has to fill, ordered by rank so the best player of every slot comes first. Only the
+    // rank 0 children can be selected right away, the rest get opened up by select_child
+    // as the node's visits grow. A player that fits several slots is only added once.
+    int count = 0;
+    *initial = 0;
+    if (context->pick >= NUMBER_OF_PICKS)
+        return 0;
+
+    int team = team_with_pick(context->pick);
+    SlotCounts requirements = context->team_requirements[team];
+    for (int rank = 0; rank < WIDENING; rank++)
     {
-        destroy_search_context(expand_context);
-        return;
+        for (int i = 0; i < NUMBER_OF_SLOTS; i++)
+        {
+            const PlayerRecord* player;
+            const Slot* slot = &config->slots[i];
+            if (count_at_slot(requirements, i) == 0 || 
+                (player = nth_best_available_at(slot, rank, &context->cursors, &context->available)) == NULL)
+                continue;
+
+            bool duplicate = false;
+            for (int j = 0; j < count && !duplicate; j++)
+                duplicate = players[j] == player;
+            if (duplicate)
+                continue;
+
+            hashes[count] = context->hash ^ zobrist_key(player->id, team);
+            players[count++] = player;
+        }
+        if (rank == 0)
+            *initial = count;
     }
-
-	const int* requirements = expand_context->team_requirements[team_with_pick(expand_context->pick)];
-	for (int i = 0; i < NUMBER_OF_SLOTS; i++)
-	{
-		const PlayerRecord* player;
-        const Slot* slot = &config->slots[i];
-		if (requirements[i] > 0 && (player = whos_highest_projected(slot, expand_context->taken, expand_context->pick, config)) != NULL)
-			node->children[i] = create_node(node, player);
-	}
-
-    destroy_search_context(expand_context);
+    return count;
 }
 
-static double simulate_score(const SearchContext* context, const Node* from_node, const DraftConfig* config)
+static int widen_children(int store, NodeRef node, const SearchContext* context, const DraftConfig* config)
 {
-	// Copy search context so we can simulate in isolation
-	SearchContext* sim_search_context = create_search_context(context->pick, context->taken, config);
-	reset_search_context_to(context, sim_search_context);
-
-	unsigned int drafting_team = team_with_pick(context->pick);
-
-	// Assume pick from from_node happened and sim remaining rounds
-	make_pick(sim_search_context, from_node->chosen_player, config);
+    int n;
+    NodeChunk* chunk = node_chunk(node, &n);
+    if (chunk->num_children[n] == chunk->num_initial[n] ||
+            atomic_load_explicit(&chunk->extra_child[n], memory_order_relaxed) != NULL_NODE ||
+            num_open_children(chunk, n, effective_visits(node)) <= chunk->num_initial[n])
+        return 0;
+
+    // Only one thread gets to allocate the block. The others keep choosing among the
+    // initial children until it is published.
+    NodeRef expected = NULL_NODE;
+    if (!atomic_compare_exchange_strong(&chunk->extra_child[n], &expected, PENDING_NODE))
+        return 0;
+
+    // The node's state is the same as when it was expanded, so the list comes out the same.
+    const PlayerRecord* players[NUMBER_OF_SLOTS * WIDENING];
+    uint64_t hashes[NUMBER_OF_SLOTS * WIDENING];
+    int initial;
+    int count = list_children(context, config, players, hashes, &initial);
+    assert(count == chunk->num_children[n] && initial == chunk->num_initial[n]);
+
+    // If the block can't be allocated the node stays PENDING_NODE and keeps its initial children.
+    NodeRef block = create_nodes(ACTIVE_STORES, store, count - initial);
+    if (block == NULL_NODE)
+        return 0;
+    for (int i = initial; i < count; i++)
+        init_node(ACTIVE_STORES, block + i - initial, players[i]->id, hashes[i]);
+    atomic_store_explicit(&chunk->extra_child[n], block, memory_order_release);
+    return count - initial;
+}
 
-	// go up branch to calculate real cumultive score to this point
-    double scores[NUMBER_OF_TEAMS];
-    for (int i = 0; i < NUMBER_OF_TEAMS; i++) scores[i] = 0;
-	double total = 0.0;
-	const Node* n = from_node;
-    int p = sim_search_context->pick - 1;
-	while (n->parent != NULL)
-	{
-        scores[team_with_pick(p)] += n->chosen_player->projected_points;
-		n = n->parent;
-        p--;
-	}
+static void simulate_score(
+        SearchContext* sim_search_context, 
+        NodeRef from_node, 
+        const DraftConfig* config, 
+        double shares[])
+{
+	// Assume pick from from_node happened and sim remaining rounds. The context already
+    // has the points of the picks on the way down the tree in its team_points.
+	make_pick(sim_search_context, node_player(from_node), config);
 
 	while (sim_search_context->pick < NUMBER_OF_PICKS)
 	{
-		const PlayerRecord* player = sim_pick_for_team(sim_search_context, config);
+		const PlayerRecord* player = sim_pick_for_team(sim_search_context);
 		assert(player != NULL);
-
-        scores[team_with_pick(sim_search_context->pick)] += player->projected_points;
-        total += player->projected_points;
-
-		make_pick(sim_search_context, player, config);
+		make_rollout_pick(sim_search_context, player, config);
 	}
 
-    // Calculate score share from sums
-    double score_share = scores[drafting_team] / total;
-
-	destroy_search_context(sim_search_context);
-	return score_share;
+    // Calculate score shares from sums. The pie is every point scored since the root, the
+    // same one update_amaf cuts its shares from, so the shares of all teams add up to 1.
+    double total = 0.0;
+    for (int i = 0; i < NUMBER_OF_TEAMS; i++)
+        total += sim_search_context->team_points[i];
+    for (int i = 0; i < NUMBER_OF_TEAMS; i++)
+        shares[i] = (total > 0.0) ? sim_search_context->team_points[i] / total : 0.0;
 }
 
-static const PlayerRecord* sim_pick_for_team(const SearchContext* context, const DraftConfig* config)
+static const PlayerRecord* sim_pick_for_team(SearchContext* context)
 {
-    int rand_index = random() % 3;
+    const PlayerRecord* candidates[NUMBER_OF_SLOTS];
+    int count = best_available_at_slots(
+            &context->cursors, context->team_requirements[team_with_pick(context->pick)], 
+            NUMBER_OF_SLOTS, candidates);
+    if (count == 0)
+        return NULL;
+
+    int rand_index = next_random(&context->rng) % 3;
 
     switch (rand_index)
     {
         case 0:
-            return zscore_pick_method(context, config);
+            return zscore_pick_method(context, candidates, count);
         case 1:
-            return greedy_pick_method(context, config);
+            return greedy_pick_method(candidates, count);
         case 2:
         default:
-            return random_pick_method(context, config);
+            return random_pick_method(&context->rng, candidates, count);
     }
 }
 
-// Chooses the player with the highest z-score. Used to represent the best "value" pick.
-static const PlayerRecord* zscore_pick_method(const SearchContext* context, const DraftConfig* config)
+// Chooses the player with the highest z-score against the players left at their position.
+// Used to represent the best "value" pick.
+static const PlayerRecord* zscore_pick_method(
+        const SearchContext* context, 
+        const PlayerRecord* const candidates[], 
+        int count)
 {
-    const PlayerRecord* picked_player = NULL;
-	const int* const still_required = context->team_requirements[team_with_pick(context->pick)];
-
-    double max_zscore = 0.0;
-    for (int i = 0; i < NUMBER_OF_SLOTS; i++)
+    const PlayerRecord* picked_player = candidates[0];
+    double max_zscore = pool_zscore(&context->pool, picked_player);
+    for (int i = 1; i < count; i++)
     {
-        const Slot* slot = &config->slots[i];
-        const PlayerRecord* player = whos_highest_projected(slot, context->taken, context->pick, config);
-        if (player && still_required[i] > 0)
+        double zscore = pool_zscore(&context->pool, candidates[i]);
+        if (zscore > max_zscore)
         {
-            double zscore = zscores[player->id];
-            if (!picked_player || zscore > max_zscore)
-            {
-                picked_player = player;
-                max_zscore = zscore;
-            }
+            picked_player = candidates[i];
+            max_zscore = zscore;
         }
     }
 
@@ -482,24 +1867,13 @@ static const PlayerRecord* zscore_pick_method(const SearchContext* context, cons
 }
 
 // Greedily chooses the draftable player with the highest projected points.
-static const PlayerRecord* greedy_pick_method(const SearchContext* context, const DraftConfig* config)
+static const PlayerRecord* greedy_pick_method(const PlayerRecord* const candidates[], int count)
 {
-    const PlayerRecord* picked_player = NULL;
-	const int* const still_required = context->team_requirements[team_with_pick(context->pick)];
-
-    double max_score = 0.0;
-    for (int i = 0; i < NUMBER_OF_SLOTS; i++)
+    const PlayerRecord* picked_player = candidates[0];
+    for (int i = 1; i < count; i++)
     {
-        const Slot* slot = &config->slots[i];
-        const PlayerRecord* player = whos_highest_projected(slot, context->taken, context->pick, config);
-        if (player && still_required[i] > 0)
-        {
-            if (!picked_player || player->projected_points > max_score)
-            {
-                picked_player = player;
-                max_score = player->projected_points;
-            }
-        }
+        if (candidates[i]->projected_points > picked_player->projected_points)
+            picked_player = candidates[i];
     }
 
     return picked_player;
@@ -507,27 +1881,10 @@ static const PlayerRecord* greedy_pick_method(const SearchContext* context, cons
 
 // Randomly selects an valid postion to draft and selects the highest projected player at that position.
 // Used to add randomness and potentially discover new, better draft routes in combination with Monte Carlo.
-static const PlayerRecord* random_pick_method(const SearchContext* context, const DraftConfig* config)
+static const PlayerRecord* random_pick_method(Rng* rng, const PlayerRecord* const candidates[], int count)
 {
-	const int* const still_required = context->team_requirements[team_with_pick(context->pick)];
-
-	const PlayerRecord* list[config->num_slots];
-    int len = 0;
-    for (int i = 0; i < config->num_slots; i++)
-    {
-        const Slot* slot = &config->slots[i];
-        const PlayerRecord* player = whos_highest_projected(slot, context->taken, context->pick, config);
-        if (player && still_required[i] > 0)
-        {
-            list[len++] = player;
-        }
-    }
-    if (len == 0)
-    {
-        return NULL;
-    }
-    int rand_index = random() % len;
-    return list[rand_index];
+    int rand_index = next_random(rng) % count;
+    return candidates[rand_index];
 }
 
 // I am taking the approach of each node's score being a average of all
@@ -537,69 +1894,73 @@ static const PlayerRecord* random_pick_method(const SearchContext* context, cons
 // take that node. Just taking the highest score could lead to the algorithm
 // favoring a path simply because the simulation phase got a lucky, but improbable, 
 // rollout for the drafting team.
-static void backpropogate_score(Node* node, double score, int team)
-{
-	if (!node)
-		return;
-    // Calculate the node's new average score.
-    // Subtract 1 from visited because the node's visited has been incremented
-    // before it has had any score assigned to it.
-    double total = (node->visited-1) * node->scores[team];
-    double new_avg =  score + total / node->visited;
-	node->scores[team] = new_avg;
-	backpropogate_score(node->parent, new_avg, team);
-}
-
-static void calculate_zscores(const DraftConfig* config)
-{
-	//TODO: Figure out what to do on FLEX positions.
-	//TODO: Fix PlayerRecord iterators so we can just do double loop.
-	// Find the "draftable pool", meaning TODO (finish comment cuz this be important)
-    int* NUM_DRAFT_POOL = malloc(sizeof(int) * NUMBER_OF_SLOTS);
-	for (int i = 0; i < NUMBER_OF_SLOTS; i++)
-	{
-		NUM_DRAFT_POOL[i] = config->slots[i].num_required * NUMBER_OF_TEAMS;
-	}
-    
-    for (int i = 0; i < number_of_players; i++)
-    {
-        const PlayerRecord* player = get_player_by_id(i);
-        int pool_size = NUM_DRAFT_POOL[player->position];
-        // calculate mean
-        double sum = 0.0;
-        int n = 0;
-        for (const PlayerRecord* p = players_begin(); p != players_end(); p = players_next())
-        {
-            if (p->position == player->position)
-            {
-                sum += p->projected_points;
-                n++;
-            }
-            if (n >= pool_size)
-            {
-                break;
-            }
-        }
-        double mean = sum / (double)n;
+//
+// Nodes keep a running sum of the scores instead of the average itself so that
+// concurrent updates from several threads are a single atomic add. The average is
+// the sum divided by the node's visits (see state_score).
+static void backpropogate_score(const NodeRef path[], int length, const double scores[])
+{
+    for (int k = length - 1; k >= 0; k--)
+    {
+        int i;
+        NodeChunk* chunk = node_chunk(path[k], &i);
+        for (int team = 0; team < NUMBER_OF_TEAMS; team++)
+            atomic_add_double(&chunk->score_sums[i * NUMBER_OF_TEAMS + team], scores[team]);
+        if (chunk->hash)
+            store_transposition(chunk->hash[i], scores);
+    }
+}
 
-        // calculate standard deviation
-        int j = 0;
-        double sum_of_squares = 0.0;
-        for (const PlayerRecord* p = players_begin(); p != players_end(); p = players_next())
+static void update_amaf(const NodeRef path[], int length, const SearchContext* sim_context, int root_pick)
+{
+    // Where every player went in the rollout and what share of the points every team got.
+    // The context was created at root_pick so its team_points only count the picks since.
+    int16_t pick_of[MAX_PLAYERS];
+    memset(pick_of, -1, sizeof(int16_t) * number_of_players);
+    for (int p = root_pick; p < sim_context->pick; p++)
+        pick_of[sim_context->taken[p].player_id] = p;
+    const double* points = sim_context->team_points;
+    double total = 0.0;
+    for (int i = 0; i < NUMBER_OF_TEAMS; i++)
+        total += points[i];
+    if (total <= 0.0)
+        return;
+
+    // The children of the node at depth k of the path are at pick root_pick + k.
+    for (int k = length - 1; k >= 0; k--)
+    {
+        int n, c;
+        int pick = root_pick + k;
+        const NodeChunk* chunk = node_chunk(path[k], &n);
+        if (atomic_load_explicit(&chunk->expansion[n], memory_order_acquire) < NODE_EXPANDED || 
+                chunk->num_children[n] == 0)
+            continue;
+
+        int team = team_with_pick(pick);
+        double share = points[team] / total;
+        NodeRef blocks[2];
+        int sizes[2];
+        int num_blocks = child_blocks(chunk, n, blocks, sizes);
+        for (int b = 0; b < num_blocks; b++)
         {
-            if (p->position == player->position)
+            NodeChunk* children = node_chunk(blocks[b], &c);
+            for (int i = c; i < c + sizes[b]; i++)
             {
-                sum_of_squares += pow(fabs(p->projected_points - mean), 2.0);
-                j++;
-            }
-            if (j >= pool_size)
-            {
-                break;
+                int taken_at = pick_of[children->player_id[i]];
+                if (taken_at >= pick && team_with_pick(taken_at) == team)
+                {
+                    atomic_fetch_add_explicit(&children->amaf_visits[i], 1, memory_order_relaxed);
+                    atomic_add_double(&children->amaf_sums[i], share);
+                }
             }
         }
-        double stddev = sqrt(sum_of_squares / n);
-
-        zscores[i] = (player->projected_points - mean) / stddev;
     }
-	free(NUM_DRAFT_POOL);
+}
+
+static void atomic_add_double(_Atomic double* target, double value)
+{
+    double expected = atomic_load_explicit(target, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(
+                target, &expected, expected + value, memory_order_relaxed, memory_order_relaxed))
+        ;
 }
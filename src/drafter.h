@@ -4,17 +4,76 @@
 #include "players.h"
 #include "config.h"
 
+// How the search threads divide up the work.
+typedef enum ParallelMode
+{
+    PARALLEL_ROOT, // every thread grows its own tree and the root statistics get merged
+    PARALLEL_TREE, // every thread descends one shared tree
+    PARALLEL_LEAF  // one thread grows the tree and the rollouts of each leaf run in parallel
+} ParallelMode;
+
+// What limits how long the engine thinks.
+typedef enum ThinkBudget
+{
+    BUDGET_TIME, // think for think_time milliseconds of wall clock time
+    BUDGET_NODES, // think until think_nodes new nodes were added to the search tree
+    BUDGET_ITERATIONS // think until think_iterations rollouts were run
+} ThinkBudget;
+
+typedef struct SearchSettings
+{
+    ThinkBudget budget;
+    int think_time; // Time in milliseconds the algorithm has before it returns an answer
+    long think_nodes;
+    long think_iterations;
+    int num_threads; // Number of threads that search in parallel (1 to MAX_THREADS)
+    ParallelMode parallel_mode;
+    int rollouts; // Number of rollouts averaged together for each new leaf (1 to MAX_ROLLOUTS)
+    long transpositions; // Number of transposition table entries. 0 searches without the table.
+    int widening; // Number of players per slot considered for each pick (1 to MAX_WIDENING)
+    int rave; // Visits at which RAVE stops dominating a node's score. 0 searches without RAVE.
+    int seed; // Seed of the rollouts. Negative seeds every search from the clock.
+} SearchSettings;
+
 // Returns the player that the engine thinks will maximize the team's fantasy points.
+// Time spent pondering on the current pick counts towards the think time when thinking
+// on a time budget. The node and iteration budgets give the same search effort no
+// matter how fast the machine is.
 //
-// @param thinking_time: Time in seconds the algorithm has before it returns an answer
+// @param settings: Controls how long and with how many threads the engine searches
 // @param pick: Initializes the search to think we are at this pick number
 // @param taken: Initializes the search to think these players are taken
 // @param draft_config: Specifies the slots and number_of_teams in draft
 const PlayerRecord* calculate_best_pick(
-    int thinking_time, 
+    const SearchSettings* settings,
     int pick, 
     Taken taken[], 
     const DraftConfig* draft_config
 );
 
+// Pondering keeps growing the search tree on a background thread (e.g while the other
+// teams are picking) until stop_pondering is called. The draft state must not change
+// while the engine is pondering. stop_pondering does nothing if the engine isn't
+// pondering.
+void start_pondering(
+    const SearchSettings* settings,
+    int pick,
+    const Taken taken[],
+    const DraftConfig* draft_config
+);
+void stop_pondering();
+
+// The engine keeps the search tree of its last search. These functions have to be
+// called as the real draft changes so the tree keeps matching the draft.
+//
+// advance_search_tree: The player was picked at the current pick of the draft. The
+// subtree under the player becomes the new search tree and the rest is freed.
+// reset_search_tree: The draft changed in any other way (undo, trades, loading).
+// Throws the tree away.
+void advance_search_tree(const PlayerRecord* player);
+void reset_search_tree();
+
+// Gives the memory the engine keeps around for its search trees back to the system.
+void free_search_memory();
+
 #endif
@@ -1,3 +1,4 @@
+#include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,12 +11,33 @@
 static PlayerRecord players[MAX_PLAYERS];
 int number_of_players = 0;
 int slot_markers[MAX_NUM_SLOTS]; // points to index of first player in each slot section
+static int slot_ends[MAX_NUM_SLOTS]; // points one past the last player in each slot section
+
+// For every slot, the ids of the players that can fill it from most to least projected points.
+// For a regular slot that is just its section of the players table but for a flex slot it is the
+// sections of all its flex options merged together. slot_ranks maps a player id back to its index
+// in a slot's order, or -1 if the player can't fill the slot.
+static int slot_orders[MAX_NUM_SLOTS][MAX_PLAYERS];
+static int slot_sizes[MAX_NUM_SLOTS];
+static int slot_ranks[MAX_NUM_SLOTS][MAX_PLAYERS];
+
+// The slots a player at each position can fill: the position's own slot and every flex slot
+// that includes it.
+static int position_slots[MAX_NUM_SLOTS][MAX_NUM_SLOTS];
+static int num_position_slots[MAX_NUM_SLOTS];
+
+// z-score of every player, indexed by player id. Sized to the player pool.
+static double* zscores = NULL;
+// Number of players at the start of each position's section that make up its draftable pool.
+static int pool_sizes[MAX_NUM_SLOTS];
 
 static int player_compare(const void* a, const void* b);
 static void group_by_position(PlayerRecord* players, const DraftConfig* config);
+static void build_slot_orders(const DraftConfig* config);
+static int calculate_zscores(const DraftConfig* config);
+static int player_id_compare(const void* a, const void* b);
 static int codify_position_str(const char* position_str, const DraftConfig* config);
 static const Slot* slot_from_position_code(int position_code, const DraftConfig* config);
-static bool does_player_match_slot(const PlayerRecord* player, const Slot* slot);
 
 int load_players(const char* csv_file, const DraftConfig* config)
 {
@@ -28,7 +50,7 @@ int load_players(const char* csv_file, const DraftConfig* config)
     char line[MAXLINE];
     while (fgets(line, MAXLINE, fp) != NULL)
     {
-        if (number_of_players > MAX_PLAYERS)
+        if (number_of_players >= MAX_PLAYERS)
         {
             fprintf(stderr, "Cannot load any more players... Try changing MAX_PLAYERS in config.\n");
             return -1;
@@ -67,10 +89,12 @@ int load_players(const char* csv_file, const DraftConfig* config)
     }
     // Here we sort the players from most to least projected points and then segment the table
     // according to the player's position.
-    // This is done to dramatically increase the performance of whos_highest_projected, and thus,
-    // the simulation phase of MCTS.
+    // This is done to dramatically increase the performance of finding the best available
+    // player at a slot, and thus, the simulation phase of MCTS.
     qsort(players, number_of_players, sizeof(PlayerRecord), player_compare);
     group_by_position(players, config);
+    if (apply_config_to_players(config) < 0)
+        return -1;
     printf("Loaded %d players.\n", number_of_players);
 
     fclose(fp);
@@ -84,79 +108,200 @@ void unload_players()
     {
         free(player->name);
     }
+    free(zscores);
+    zscores = NULL;
 }
 
-int is_taken(int player_id, const Taken taken[], int passed_picks)
+int apply_config_to_players(const DraftConfig* config)
 {
-	for (int i = 0; i < passed_picks; i++)
-	{
-		if (taken[i].player_id == player_id) {
-			return 1;
-		}
-	}
-	return 0;
+    build_slot_orders(config);
+    return calculate_zscores(config);
 }
 
-const PlayerRecord* whos_highest_projected(
-        const Slot* slot, 
-        const Taken taken[], 
-        int passed_picks,
-        const DraftConfig* config
-        )
+static int calculate_zscores(const DraftConfig* config)
+{
+    double* table = realloc(zscores, sizeof(double) * (number_of_players > 0 ? number_of_players : 1));
+    if (!table)
+        return -1;
+    zscores = table;
+
+    // The players are grouped by position from most to least projected points, so the
+    // draftable pool of a position is the start of its section of the players table.
+    double mean[MAX_NUM_SLOTS] = {0};
+    double stddev[MAX_NUM_SLOTS] = {0};
+    for (int position = 0; position < MAX_NUM_SLOTS; position++)
+    {
+        pool_sizes[position] = 0;
+        if (position >= config->num_slots || is_flex_slot(&config->slots[position]))
+            continue;
+
+        int pool_size = config->slots[position].num_required * config->num_teams;
+        int n = slot_ends[position] - slot_markers[position];
+        if (n > pool_size)
+            n = pool_size;
+        if (n <= 0)
+            continue;
+        pool_sizes[position] = n;
+
+        double sum = 0.0;
+        for (int i = slot_markers[position]; i < slot_markers[position] + n; i++)
+            sum += players[i].projected_points;
+        mean[position] = sum / n;
+
+        double sum_of_squares = 0.0;
+        for (int i = slot_markers[position]; i < slot_markers[position] + n; i++)
+            sum_of_squares += pow(players[i].projected_points - mean[position], 2.0);
+        stddev[position] = sqrt(sum_of_squares / n);
+    }
+
+    for (int i = 0; i < number_of_players; i++)
+    {
+        const PlayerRecord* player = &players[i];
+        double deviation = stddev[player->position];
+        zscores[player->id] = (deviation > 0.0) ? (player->projected_points - mean[player->position]) / deviation : 0.0;
+    }
+    return 0;
+}
+
+double get_zscore(unsigned int player_id)
+{
+    return zscores[player_id];
+}
+
+static bool in_draftable_pool(const PlayerRecord* player)
+{
+    return (int)player->id - slot_markers[player->position] < pool_sizes[player->position];
+}
+
+void init_pool_stats(PoolStats* pool, const Availability* availability)
 {
-    // hacky way to cache taken so we don't have to call is_taken for every player which can get expensive
-    // and not break existing interfaces.
-    int taken_cache[1000] = {0};
-    for (int i = 0; i < passed_picks; i++) 
-        taken_cache[taken[i].player_id] = 1; // cache size needs to be > than biggest id
-
-    // TODO: Temp solution to solving flex slots with this new method.
-    if (is_flex_slot(slot))
+    memset(pool, 0, sizeof(PoolStats));
+    for (int i = 0; i < number_of_players; i++)
     {
-        double max_score = 0.0;
-        const PlayerRecord* highest = NULL;
-        for (int i = 0; i < slot->num_flex_options; i++)
+        if (is_available(availability, players[i].id) && in_draftable_pool(&players[i]))
         {
-            const PlayerRecord* p = whos_highest_projected(
-                    &config->slots[slot->flex[i]], 
-                    taken, 
-                    passed_picks,
-                    config);
-            if (p->projected_points > max_score)
-            {
-                highest = p;
-                max_score = p->projected_points;
-            }
+            double points = players[i].projected_points;
+            pool->count[players[i].position]++;
+            pool->sum[players[i].position] += points;
+            pool->sum_of_squares[players[i].position] += points * points;
         }
-        return highest;
     }
+}
 
-    int slot_mark = slot_markers[slot->index];
-    // TODO: Could calculate end of search bounds using next slot_mark instead of using number_of_players.
-    for (int i = slot_mark; i < number_of_players; i++)
+void remove_from_pool(PoolStats* pool, const PlayerRecord* player, PoolSums* prior)
+{
+    if (!in_draftable_pool(player))
+        return;
+    if (prior)
     {
-        if (taken_cache[players[i].id] == 0)
-            return &players[i];
+        prior->sum = pool->sum[player->position];
+        prior->sum_of_squares = pool->sum_of_squares[player->position];
+    }
+    double points = player->projected_points;
+    pool->count[player->position]--;
+    pool->sum[player->position] -= points;
+    pool->sum_of_squares[player->position] -= points * points;
+}
+
+void return_to_pool(PoolStats* pool, const PlayerRecord* player, const PoolSums* prior)
+{
+    if (!in_draftable_pool(player))
+        return;
+    pool->count[player->position]++;
+    pool->sum[player->position] = prior->sum;
+    pool->sum_of_squares[player->position] = prior->sum_of_squares;
+}
+
+double pool_zscore(const PoolStats* pool, const PlayerRecord* player)
+{
+    int n = pool->count[player->position];
+    if (n < 2)
+        return zscores[player->id];
+
+    double mean = pool->sum[player->position] / n;
+    double variance = pool->sum_of_squares[player->position] / n - mean * mean;
+    if (variance <= 0.0)
+        return zscores[player->id];
+    return (player->projected_points - mean) / sqrt(variance);
+}
+
+void init_availability(Availability* availability, const Taken taken[], int passed_picks)
+{
+    memset(availability->taken, 0, sizeof(availability->taken));
+    for (int i = 0; i < passed_picks; i++)
+        mark_taken(availability, taken[i].player_id);
+}
+
+void init_position_cursors(PositionCursors* cursors, const Availability* availability, const DraftConfig* config)
+{
+    for (int i = 0; i < config->num_slots; i++)
+    {
+        int next = 0;
+        while (next < slot_sizes[i] && !is_available(availability, slot_orders[i][next]))
+            next++;
+        cursors->next[i] = next;
+    }
+}
+
+void advance_position_cursor(PositionCursors* cursors, const PlayerRecord* player, const Availability* availability)
+{
+    for (int i = 0; i < num_position_slots[player->position]; i++)
+    {
+        int slot = position_slots[player->position][i];
+        // Taking anyone other than the best available player for the slot doesn't move the cursor.
+        int* next = &cursors->next[slot];
+        if (*next >= slot_sizes[slot] || slot_orders[slot][*next] != (int)player->id)
+            continue;
+
+        while (*next < slot_sizes[slot] && !is_available(availability, slot_orders[slot][*next]))
+            (*next)++;
+    }
+}
+
+void rewind_position_cursor(PositionCursors* cursors, const PlayerRecord* player)
+{
+    // A returned player that sorts ahead of a cursor is now the best available for that slot.
+    for (int i = 0; i < num_position_slots[player->position]; i++)
+    {
+        int slot = position_slots[player->position][i];
+        int rank = slot_ranks[slot][player->id];
+        if (rank < cursors->next[slot])
+            cursors->next[slot] = rank;
+    }
+}
+
+int best_available_at_slots(
+        const PositionCursors* cursors, 
+        SlotCounts needed, 
+        int num_slots, 
+        const PlayerRecord* best[]
+        )
+{
+    int count = 0;
+    for (int i = 0; i < num_slots; i++)
+    {
+        int next = cursors->next[i];
+        if (count_at_slot(needed, i) > 0 && next < slot_sizes[i])
+            best[count++] = &players[slot_orders[i][next]];
+    }
+    return count;
+}
+
+const PlayerRecord* nth_best_available_at(
+        const Slot* slot, 
+        int rank, 
+        const PositionCursors* cursors, 
+        const Availability* availability
+        )
+{
+    // Everyone ahead of the cursor is taken so the scan can start there.
+    const int* order = slot_orders[slot->index];
+    for (int i = cursors->next[slot->index]; i < slot_sizes[slot->index]; i++)
+    {
+        if (is_available(availability, order[i]) && rank-- == 0)
+            return &players[order[i]];
     }
     return NULL;
-    /*
-    double max_score = 0.0;
-    const PlayerRecord* highest = NULL;
-	const PlayerRecord* player = players_begin();
-	for (; player != players_end(); player = players_next()) 
-	{
-        if (
-            taken_cache[player->id] < 0 && 
-            player->projected_points > max_score &&
-            does_player_match_slot(player, slot)
-           )
-        {
-            highest = player;
-            max_score = player->projected_points;
-        }
-	}
-    return highest;
-    */
 }
 
 const PlayerRecord* get_player_by_id(unsigned int player_id)
@@ -258,19 +403,13 @@ static void group_by_position(PlayerRecord* players, const DraftConfig* config)
             continue;
 
         int slot_index = i;
-        bool set_marker = true;
+        slot_markers[slot_index] = last_index;
         for (int j = 0; j < number_of_players; j++)
         {
             if (players[j].position == slot_index)
-            {
-                if (set_marker)
-                {
-                    slot_markers[slot_index] = last_index;
-                    set_marker = false;
-                }
                 placeholder[last_index++] = players[j];
-            }
         }
+        slot_ends[slot_index] = last_index;
     }
 
     for (int i = 0; i < number_of_players; i++)
@@ -283,6 +422,59 @@ static void group_by_position(PlayerRecord* players, const DraftConfig* config)
     free(placeholder);
 }
 
+// Builds slot_orders, slot_ranks and position_slots from the grouped players table.
+static void build_slot_orders(const DraftConfig* config)
+{
+    for (int i = 0; i < config->num_slots; i++)
+    {
+        const Slot* slot = &config->slots[i];
+        int size = 0;
+        if (!is_flex_slot(slot))
+        {
+            for (int j = slot_markers[i]; j < slot_ends[i]; j++)
+                slot_orders[i][size++] = j;
+        }
+        else
+        {
+            for (int k = 0; k < slot->num_flex_options; k++)
+            {
+                int position = slot->flex[k];
+                for (int j = slot_markers[position]; j < slot_ends[position]; j++)
+                    slot_orders[i][size++] = j;
+            }
+            qsort(slot_orders[i], size, sizeof(int), player_id_compare);
+        }
+        slot_sizes[i] = size;
+
+        for (int j = 0; j < number_of_players; j++)
+            slot_ranks[i][j] = -1;
+        for (int j = 0; j < size; j++)
+            slot_ranks[i][slot_orders[i][j]] = j;
+    }
+
+    for (int i = 0; i < config->num_slots; i++)
+    {
+        num_position_slots[i] = 0;
+        if (is_flex_slot(&config->slots[i]))
+            continue;
+        position_slots[i][num_position_slots[i]++] = i;
+        for (int j = 0; j < config->num_slots; j++)
+        {
+            if (is_flex_slot(&config->slots[j]) && flex_includes_position(&config->slots[j], i))
+                position_slots[i][num_position_slots[i]++] = j;
+        }
+    }
+}
+
+// Orders player ids by their player's projected points, most to least. Ties keep table order.
+static int player_id_compare(const void* a, const void* b)
+{
+    int ia = *(const int*)a;
+    int ib = *(const int*)b;
+    int by_points = player_compare(&players[ia], &players[ib]);
+    return by_points != 0 ? by_points : ia - ib;
+}
+
 // Maps a player's position_str to the matching slot defined in the DraftConfig.
 // Returns the index of the matching slot in the DraftConfig's slots array.
 static int codify_position_str(const char* position_str, const DraftConfig* config)
@@ -305,16 +497,3 @@ static const Slot* slot_from_position_code(int code, const DraftConfig* config)
         return NULL;
     return &config->slots[code];
 }
-
-static bool does_player_match_slot(const PlayerRecord* player, const Slot* slot)
-{
-    if (is_flex_slot(slot))
-    {
-        for (int i = 0; i < slot->num_flex_options; i++)
-        {
-            if (player->position == slot->flex[i])
-                return true;
-        }
-    }    
-    return player->position == slot->index;
-}
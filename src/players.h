@@ -1,6 +1,11 @@
 #ifndef PLAYERS_H
 #define PLAYERS_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+
 extern int number_of_players;
 
 typedef struct PlayerRecord {
@@ -19,22 +24,117 @@ int load_players(const char* csv_file, const struct DraftConfig* config);
 
 void unload_players();
 
+// Rebuilds what load_players derives from the config for the loaded pool: the merged
+// orderings of the flex slots and the z-score of every player's projected points against the
+// draftable pool of the player's position, i.e the num_required * num_teams most projected
+// players at the position. It has to be redone when the config changes. The players keep the
+// positions they were loaded with, so the new config has to list the same positions.
+// Returns -1 if the z-score table could not be allocated.
+int apply_config_to_players(const struct DraftConfig* config);
+
+double get_zscore(unsigned int player_id);
+
 typedef struct Taken {
 	unsigned int player_id;
 	unsigned int by_team; // index into DRAFT_ORDER array in config.h
 } Taken;
 
-int is_taken(int player_id, const Taken taken[], int passed_picks);
+// Bitset keyed by player id of the players that have been taken. It is kept up to date
+// as picks are made and taken back, so checking if a player is still available is a
+// single bit test instead of a scan over the taken list.
+typedef struct Availability
+{
+    uint64_t taken[(MAX_PLAYERS + 63) / 64];
+} Availability;
 
-// Gets record of the player with the highest projected points at the given slot who's id is NOT in
-// the taken list.
-const PlayerRecord* whos_highest_projected(
-        const struct Slot* slot, 
-        const Taken taken[], 
-        int passed_picks,
+// Marks every player as available and then marks the first passed_picks picks in taken.
+void init_availability(Availability* availability, const Taken taken[], int passed_picks);
+
+static inline void mark_taken(Availability* availability, unsigned int player_id)
+{
+    availability->taken[player_id / 64] |= (uint64_t)1 << (player_id % 64);
+}
+
+static inline void mark_available(Availability* availability, unsigned int player_id)
+{
+    availability->taken[player_id / 64] &= ~((uint64_t)1 << (player_id % 64));
+}
+
+static inline bool is_available(const Availability* availability, unsigned int player_id)
+{
+    return !(availability->taken[player_id / 64] & ((uint64_t)1 << (player_id % 64)));
+}
+
+// For every slot, where the highest projected player who is still available and can
+// fill the slot sits in the slot's player ordering. Flex slots have their own ordering
+// that merges all of their flex options. The cursors have to be told about every pick
+// made and taken back through advance_position_cursor and rewind_position_cursor so
+// they stay in sync with the availability bitset they were initialized from.
+typedef struct PositionCursors
+{
+    int next[MAX_NUM_SLOTS];
+} PositionCursors;
+
+void init_position_cursors(
+        PositionCursors* cursors, 
+        const Availability* availability, 
         const struct DraftConfig* config
 );
 
+// Call after player has been marked taken.
+void advance_position_cursor(PositionCursors* cursors, const PlayerRecord* player, const Availability* availability);
+
+// Call after player has been marked available again.
+void rewind_position_cursor(PositionCursors* cursors, const PlayerRecord* player);
+
+// Puts the best available player of every slot still open in needed into best, skipping
+// slots that have nobody left. Returns the number of players put into best.
+int best_available_at_slots(
+        const PositionCursors* cursors, 
+        SlotCounts needed, 
+        int num_slots, 
+        const PlayerRecord* best[]
+);
+
+// The available player that is rank places behind the best available player at the slot
+// (rank 0 is the best available player). Returns NULL if fewer players are left.
+const PlayerRecord* nth_best_available_at(
+        const struct Slot* slot, 
+        int rank, 
+        const PositionCursors* cursors, 
+        const Availability* availability
+);
+
+// Running count, sum and sum of squares of the projected points of the players who are still
+// available in every position's draftable pool. It has to be told about every pick made and
+// taken back through remove_from_pool and return_to_pool, which are O(1), so z-scores can be
+// taken against the players who are left instead of the whole pool.
+typedef struct PoolStats
+{
+    int count[MAX_NUM_SLOTS];
+    double sum[MAX_NUM_SLOTS];
+    double sum_of_squares[MAX_NUM_SLOTS];
+} PoolStats;
+
+// Sums of a position's pool before a player was removed from it. return_to_pool restores the
+// sums from it instead of adding the player's points back, so they don't drift over millions
+// of picks taken back.
+typedef struct PoolSums
+{
+    double sum;
+    double sum_of_squares;
+} PoolSums;
+
+// Adds every available player of the draftable pools.
+void init_pool_stats(PoolStats* pool, const Availability* availability);
+// prior is filled in with the sums before the removal. NULL if the pick is never taken back.
+void remove_from_pool(PoolStats* pool, const PlayerRecord* player, PoolSums* prior);
+void return_to_pool(PoolStats* pool, const PlayerRecord* player, const PoolSums* prior);
+
+// z-score of the player against what is left of the draftable pool at the player's position.
+// Falls back to get_zscore once fewer than two players are left in the pool.
+double pool_zscore(const PoolStats* pool, const PlayerRecord* player);
+
 const PlayerRecord* get_player_by_id(unsigned int player_id);
 const PlayerRecord* get_player_by_name(const char* name);
 
@@ -0,0 +1,127 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "pool.h"
+
+struct ThreadPool
+{
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+
+    // The batch that is currently running. Guarded by lock.
+    PoolTask task;
+    void* arg;
+    int count;
+    int next; // next index of the batch to hand out
+    int remaining; // number of tasks of the batch that have not finished
+
+    bool shutdown;
+    int num_threads;
+    pthread_t threads[];
+};
+
+static void* pool_thread(void* arg);
+
+// Hands out the next task of the running batch and runs it. Must be called with the
+// pool's lock held and returns with it held. Returns false if there was nothing to do.
+static bool run_next_task(ThreadPool* pool);
+
+ThreadPool* create_pool(int num_threads)
+{
+    ThreadPool* pool = malloc(sizeof(ThreadPool) + sizeof(pthread_t) * num_threads);
+    if (!pool)
+        return NULL;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+    pool->task = NULL;
+    pool->arg = NULL;
+    pool->count = 0;
+    pool->next = 0;
+    pool->remaining = 0;
+    pool->shutdown = false;
+    pool->num_threads = 0;
+
+    for (int i = 0; i < num_threads; i++)
+    {
+        if (pthread_create(&pool->threads[i], NULL, pool_thread, pool) != 0)
+        {
+            destroy_pool(pool);
+            return NULL;
+        }
+        pool->num_threads++;
+    }
+
+    return pool;
+}
+
+void destroy_pool(ThreadPool* pool)
+{
+    if (!pool)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->num_threads; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_cond_destroy(&pool->work_done);
+    free(pool);
+}
+
+void pool_run(ThreadPool* pool, PoolTask task, void* arg, int count)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->arg = arg;
+    pool->count = count;
+    pool->next = 0;
+    pool->remaining = count;
+    pthread_cond_broadcast(&pool->work_ready);
+
+    while (run_next_task(pool))
+        ;
+    while (pool->remaining > 0)
+        pthread_cond_wait(&pool->work_done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void* pool_thread(void* arg)
+{
+    ThreadPool* pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->shutdown)
+    {
+        if (!run_next_task(pool))
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+static bool run_next_task(ThreadPool* pool)
+{
+    if (pool->next >= pool->count)
+        return false;
+
+    int index = pool->next++;
+    PoolTask task = pool->task;
+    void* arg = pool->arg;
+    pthread_mutex_unlock(&pool->lock);
+    task(arg, index);
+    pthread_mutex_lock(&pool->lock);
+
+    if (--pool->remaining == 0)
+        pthread_cond_signal(&pool->work_done);
+    return true;
+}
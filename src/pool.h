@@ -0,0 +1,19 @@
+#ifndef POOL_H
+#define POOL_H
+
+// A fork-join thread pool. The pool's threads sleep until pool_run hands them a
+// batch of tasks and pool_run only returns once every task in the batch is done.
+typedef struct ThreadPool ThreadPool;
+
+// Work function of a batch. Gets called once for every index in [0, count).
+typedef void (*PoolTask)(void* arg, int index);
+
+// Starts num_threads helper threads. Returns NULL on failure.
+ThreadPool* create_pool(int num_threads);
+void destroy_pool(ThreadPool* pool);
+
+// Runs task(arg, i) for every i in [0, count) on the pool's threads. The calling
+// thread works on the batch as well, so a pool with 0 threads runs it serially.
+void pool_run(ThreadPool* pool, PoolTask task, void* arg, int count);
+
+#endif
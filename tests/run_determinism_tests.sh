@@ -0,0 +1,36 @@
+#!/bin/sh
+# Runs every tests/determinism/*.txt command script through fdraft twice and compares the
+# output. The scripts fix the seed and search on an iteration budget, so both runs have
+# to pick exactly the same players.
+#
+# Run from anywhere with `make test`.
+
+cd "$(dirname "$0")/.." || exit 1
+TEST_TIMEOUT=${TEST_TIMEOUT:-60}
+
+first=$(mktemp) || exit 1
+second=$(mktemp) || exit 1
+trap 'rm -f "$first" "$second"' EXIT
+
+failed=0
+for test in tests/determinism/*.txt
+do
+    timeout "$TEST_TIMEOUT" ./fdraft < "$test" > "$first" 2> /dev/null
+    first_status=$?
+    timeout "$TEST_TIMEOUT" ./fdraft < "$test" > "$second" 2> /dev/null
+    second_status=$?
+    if [ $first_status -ne 0 ] || [ $second_status -ne 0 ]
+    then
+        echo "FAIL $test (exit status $first_status, $second_status)"
+        failed=$((failed + 1))
+    elif ! cmp -s "$first" "$second"
+    then
+        echo "FAIL $test (runs differ)"
+        diff "$first" "$second" | head -n 10
+        failed=$((failed + 1))
+    else
+        echo "PASS $test"
+    fi
+done
+
+[ $failed -eq 0 ]
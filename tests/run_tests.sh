@@ -0,0 +1,25 @@
+#!/bin/sh
+# Feeds every tests/*.txt command script to fdraft. A test fails if fdraft reports an
+# error, crashes, or doesn't exit within TEST_TIMEOUT seconds.
+#
+# Run from anywhere with `make test`.
+
+cd "$(dirname "$0")/.." || exit 1
+TEST_TIMEOUT=${TEST_TIMEOUT:-60}
+
+failed=0
+for test in tests/*.txt
+do
+    errors=$(timeout "$TEST_TIMEOUT" ./fdraft < "$test" 2>&1 > /dev/null)
+    status=$?
+    if [ $status -ne 0 ] || echo "$errors" | grep -q "Error"
+    then
+        echo "FAIL $test (exit status $status)"
+        echo "$errors" | grep "Error"
+        failed=$((failed + 1))
+    else
+        echo "PASS $test"
+    fi
+done
+
+[ $failed -eq 0 ]